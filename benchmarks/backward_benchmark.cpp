@@ -0,0 +1,50 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <ugrad/engine.hpp>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// sum = ((x + x) + x) + ..., the graph std::accumulate builds
+static ValuePtr build_chain(size_t nodes) {
+  auto x = make_shared<Value>(1.0);
+  auto sum = make_shared<Value>(0.0);
+  for (size_t i = 2; i < nodes; ++i) {
+    sum = sum + x;
+  }
+  return sum;
+}
+
+int main(int argc, char* argv[]) {
+  size_t max_nodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+  fmt::print("sizeof(Value): {} bytes\n", sizeof(Value));
+  fmt::print("{:>10} {:>12} {:>10} {:>10} {:>12}\n", "nodes", "backward ms",
+             "ns/node", "drop ms", "deferred ms");
+  for (size_t nodes = 1000; nodes <= max_nodes; nodes *= 10) {
+    auto root = build_chain(nodes);
+    auto start = steady_clock::now();
+    root->backward();
+    duration<double> elapsed = steady_clock::now() - start;
+
+    // time the dropping thread spends on teardown, in place and deferred
+    start = steady_clock::now();
+    root.reset();
+    duration<double> drop = steady_clock::now() - start;
+    root = build_chain(nodes);
+    Reclaimer::set_deferred(true);
+    start = steady_clock::now();
+    root.reset();
+    duration<double> deferred = steady_clock::now() - start;
+    Reclaimer::drain();
+    Reclaimer::set_deferred(false);
+
+    fmt::print("{:>10} {:>12.3f} {:>10.1f} {:>10.3f} {:>12.3f}\n", nodes,
+               elapsed.count() * 1e3, elapsed.count() * 1e9 / nodes,
+               drop.count() * 1e3, deferred.count() * 1e3);
+  }
+  return 0;
+}
@@ -0,0 +1,62 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ugrad/engine.hpp>
+#include <ugrad/nn.hpp>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// Forward and backward of the moons MLP over a minibatch, sample by sample
+// (a graph per sample) and as one [batch x 2] tensor (a node per layer).
+static vector<double> moons_batch(size_t batch) {
+  vector<double> data(batch * 2);
+  for (size_t i = 0; i < batch; ++i) {
+    auto t = 3.14159 * i / batch;
+    data[2 * i] = i % 2 ? 1.0 - std::cos(t) : std::cos(t);
+    data[2 * i + 1] = i % 2 ? 0.5 - std::sin(t) : std::sin(t);
+  }
+  return data;
+}
+
+static double per_sample_ms(MLP& model, const vector<double>& data) {
+  auto start = steady_clock::now();
+  vector<ValuePtr> outs;
+  for (size_t i = 0; i < data.size() / 2; ++i) {
+    vector<ValuePtr> x{make_shared<Value>(data[2 * i], false),
+                       make_shared<Value>(data[2 * i + 1], false)};
+    outs.push_back(model(x)[0]);
+  }
+  sum(outs)->backward();
+  outs.clear();
+  duration<double> elapsed = steady_clock::now() - start;
+  return elapsed.count() * 1e3;
+}
+
+static double batched_ms(MLP& model, const vector<double>& data) {
+  auto start = steady_clock::now();
+  auto x = make_tensor(data.size() / 2, 2, data, false);
+  sum(model(x))->backward();
+  duration<double> elapsed = steady_clock::now() - start;
+  return elapsed.count() * 1e3;
+}
+
+int main(int argc, char* argv[]) {
+  size_t max_batch = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  auto model = MLP(2, {16, 16, 1});
+  fmt::print("MLP(2, [16, 16, 1]), forward + backward\n");
+  fmt::print("{:>8} {:>14} {:>12} {:>9}\n", "batch", "per sample ms",
+             "batched ms", "speedup");
+  for (size_t batch = 100; batch <= max_batch; batch *= 10) {
+    auto data = moons_batch(batch);
+    auto scalar = per_sample_ms(model, data);
+    batched_ms(model, data);
+    auto tensor = batched_ms(model, data);
+    fmt::print("{:>8} {:>14.3f} {:>12.3f} {:>9.1f}\n", batch, scalar, tensor,
+               scalar / tensor);
+  }
+  return 0;
+}
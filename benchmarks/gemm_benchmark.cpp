@@ -0,0 +1,79 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <tuple>
+#include <ugrad/gemm.hpp>
+#include <vector>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::vector;
+
+// GFLOP/s of the blocked gemm, per micro-kernel and on the default pool,
+// against the naive triple loop, for square and for skinny shapes such as
+// the [batch x in] * [in x out] products of a Linear layer.
+template <typename F>
+static double gflops(size_t m, size_t n, size_t k, F&& run) {
+  // repeat until the timing covers at least 0.2 s
+  size_t reps = 0;
+  auto start = steady_clock::now();
+  duration<double> elapsed{};
+  do {
+    run();
+    ++reps;
+    elapsed = steady_clock::now() - start;
+  } while (elapsed.count() < 0.2);
+  return 2.0 * m * n * k * reps / elapsed.count() * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+  size_t threads = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 0;
+  if (threads) {
+    set_num_threads(threads);
+  }
+  vector<std::tuple<size_t, size_t, size_t>> shapes = {
+      {64, 64, 64},   {256, 256, 256}, {512, 512, 512}, {1024, 1024, 1024},
+      {32, 512, 512}, {512, 32, 512},  {512, 512, 32},  {4096, 16, 64},
+      {1, 1024, 1024}};
+  vector<GemmIsa> isas;
+  for (auto isa :
+       {GemmIsa::Scalar, GemmIsa::SSE2, GemmIsa::AVX2, GemmIsa::AVX512}) {
+    if (gemm_supports(isa)) {
+      isas.push_back(isa);
+    }
+  }
+  auto best = gemm_isa();
+
+  fmt::print("GFLOP/s, {} threads\n", num_threads());
+  fmt::print("{:>16} {:>8}", "m x n x k", "naive");
+  for (auto isa : isas) {
+    fmt::print(" {:>8}", gemm_kernel(isa).name);
+  }
+  fmt::print(" {:>9}\n", "speedup");
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  for (auto [m, n, k] : shapes) {
+    vector<double> a(m * k), b(k * n), c(m * n);
+    for (auto& v : a) v = dist(rng);
+    for (auto& v : b) v = dist(rng);
+    auto naive = gflops(m, n, k, [&] {
+      gemm_reference(false, false, m, n, k, a.data(), b.data(), c.data());
+    });
+    fmt::print("{:>16} {:>8.2f}", fmt::format("{}x{}x{}", m, n, k), naive);
+    double fastest = 0.0;
+    for (auto isa : isas) {
+      set_gemm_isa(isa);
+      auto blocked = gflops(m, n, k, [&] {
+        gemm(false, false, m, n, k, a.data(), b.data(), c.data());
+      });
+      fastest = std::max(fastest, blocked);
+      fmt::print(" {:>8.2f}", blocked);
+    }
+    fmt::print(" {:>8.1f}x\n", fastest / naive);
+  }
+  set_gemm_isa(best);
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <ugrad/engine.hpp>
+#include <ugrad/tape.hpp>
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// Neuron-shaped graphs: `fan_in` products, a chain of adds and a relu per
+// neuron, repeated until the graph holds about `nodes` nodes.
+constexpr size_t fan_in = 16;
+
+static double value_backward_ns(size_t nodes) {
+  using namespace ugrad;
+  vector<ValuePtr> x, w;
+  for (size_t i = 0; i < fan_in; ++i) {
+    x.push_back(make_shared<Value>(i * 0.1));
+    w.push_back(make_shared<Value>(1.0 - i * 0.1));
+  }
+  auto total = make_shared<Value>(0.0);
+  size_t built = 2 * fan_in + 1;
+  while (built < nodes) {
+    vector<ValuePtr> prods;
+    for (size_t i = 0; i < fan_in; ++i) {
+      prods.push_back(x[i] * w[i]);
+    }
+    auto act = prods[0];
+    for (size_t i = 1; i < fan_in; ++i) {
+      act = act + prods[i];
+    }
+    total = total + act->relu();
+    built += 2 * fan_in + 1;
+  }
+  auto start = steady_clock::now();
+  total->backward();
+  duration<double> elapsed = steady_clock::now() - start;
+  return elapsed.count() * 1e9 / built;
+}
+
+static double tape_backward_ns(size_t nodes) {
+  using namespace ugrad::tape;
+  Tape tape(nodes + 4 * fan_in);
+  vector<Var> x, w;
+  for (size_t i = 0; i < fan_in; ++i) {
+    x.push_back(tape.var(i * 0.1));
+    w.push_back(tape.var(1.0 - i * 0.1));
+  }
+  auto total = tape.var(0.0);
+  vector<Var> prods(fan_in);
+  while (tape.size() < nodes) {
+    for (size_t i = 0; i < fan_in; ++i) {
+      prods[i] = x[i] * w[i];
+    }
+    auto act = prods[0];
+    for (size_t i = 1; i < fan_in; ++i) {
+      act = act + prods[i];
+    }
+    total = total + act.relu();
+  }
+  auto start = steady_clock::now();
+  total.backward();
+  duration<double> elapsed = steady_clock::now() - start;
+  return elapsed.count() * 1e9 / tape.size();
+}
+
+int main(int argc, char* argv[]) {
+  size_t nodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+  const int reps = 5;
+
+  double value_ns = 0.0, tape_ns = 0.0;
+  for (auto rep = 0; rep < reps; ++rep) {
+    value_ns += value_backward_ns(nodes) / reps;
+    tape_ns += tape_backward_ns(nodes) / reps;
+  }
+  fmt::print("backward over {} nodes\n", nodes);
+  fmt::print("{:>24} {:>8.1f} ns/node\n", "Value (shared_ptr)", value_ns);
+  fmt::print("{:>24} {:>8.1f} ns/node\n", "tape (struct of arrays)", tape_ns);
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <ugrad/engine.hpp>
+#include <ugrad/nn.hpp>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// One training step (forward, loss, backward) of an MLP with two wide hidden
+// layers over a minibatch, built from scalar Layers and from Linear layers.
+constexpr size_t in_nr = 16;
+constexpr size_t batch = 32;
+
+static double scalar_step_ms(size_t width) {
+  auto model = MLP(in_nr, {width, width, 1});
+  auto start = steady_clock::now();
+  vector<ValuePtr> outs;
+  for (size_t i = 0; i < batch; ++i) {
+    vector<ValuePtr> x;
+    for (size_t j = 0; j < in_nr; ++j) {
+      x.push_back(make_shared<Value>(0.01 * (i + j), false));
+    }
+    outs.push_back(model(x)[0]);
+  }
+  sum(outs)->backward();
+  duration<double> elapsed = steady_clock::now() - start;
+  return elapsed.count() * 1e3;
+}
+
+static double linear_step_ms(size_t width) {
+  auto model = MLP(in_nr, {width, width, 1}, LayerKind::Linear);
+  vector<double> data(batch * in_nr);
+  for (size_t i = 0; i < batch; ++i) {
+    for (size_t j = 0; j < in_nr; ++j) {
+      data[i * in_nr + j] = 0.01 * (i + j);
+    }
+  }
+  auto start = steady_clock::now();
+  auto x = make_tensor(batch, in_nr, data, false);
+  sum(model(x))->backward();
+  duration<double> elapsed = steady_clock::now() - start;
+  return elapsed.count() * 1e3;
+}
+
+int main(int argc, char* argv[]) {
+  size_t max_width = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 512;
+  fmt::print("MLP({}, [w, w, 1]), batch {}\n", in_nr, batch);
+  fmt::print("{:>6} {:>12} {:>12} {:>9}\n", "w", "scalar ms", "linear ms",
+             "speedup");
+  for (size_t width = 32; width <= max_width; width *= 2) {
+    auto scalar = scalar_step_ms(width);
+    auto tensor = linear_step_ms(width);
+    fmt::print("{:>6} {:>12.3f} {:>12.3f} {:>9.1f}\n", width, scalar, tensor,
+               scalar / tensor);
+  }
+  return 0;
+}
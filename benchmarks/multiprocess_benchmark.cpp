@@ -0,0 +1,66 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <ugrad/multiprocess.hpp>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// Epoch time of train_processes on a synthetic moons dataset, from one
+// process up to one per hardware thread (or the second argument). The time
+// includes forking the processes and handing the weights back.
+
+// two interleaved half circles with noise, labels -1 and 1
+static std::pair<ValuePtr, ValuePtr> moons(size_t samples) {
+  std::mt19937 rng{0};
+  std::uniform_real_distribution<> angle{0.0, 3.14159265358979};
+  std::normal_distribution<> noise{0.0, 0.1};
+  vector<double> x(samples * 2), y(samples);
+  for (size_t i = 0; i < samples; ++i) {
+    auto t = angle(rng);
+    auto upper = i % 2 == 0;
+    x[2 * i] = (upper ? std::cos(t) : 1.0 - std::cos(t)) + noise(rng);
+    x[2 * i + 1] = (upper ? std::sin(t) : 0.5 - std::sin(t)) + noise(rng);
+    y[i] = upper ? -1.0 : 1.0;
+  }
+  return {make_tensor(samples, 2, std::move(x), false),
+          make_tensor(samples, 1, std::move(y), false)};
+}
+
+int main(int argc, char* argv[]) {
+  size_t samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+  size_t max_ranks = argc > 2 ? std::strtoull(argv[2], nullptr, 10)
+                              : std::thread::hardware_concurrency();
+  const size_t batch = 8192;
+  auto [xs, ys] = moons(samples);
+  auto& x = xs->tensor();
+  auto& y = ys->tensor();
+  fmt::print("MLP(2, [16, 16, 1]), {} samples, minibatch {}, SGD\n", samples,
+             batch);
+  fmt::print("{:>9} {:>10} {:>9} {:>9} {:>9}\n", "processes", "epoch s",
+             "speedup", "loss", "accuracy");
+  double serial = 0.0;
+  for (size_t ranks = 1; ranks <= std::max<size_t>(max_ranks, 1); ++ranks) {
+    MLP model{2, {16, 16, 1}, LayerKind::Linear};
+    optim::SGD sgd{model.parameters(), 0.1, 0.9};
+    auto start = steady_clock::now();
+    auto stats = train_processes(ranks, model, sgd, x, y, batch, 1);
+    duration<double> elapsed = steady_clock::now() - start;
+    if (stats.empty()) {
+      fmt::print("training on {} processes failed\n", ranks);
+      return 1;
+    }
+    if (ranks == 1) {
+      serial = elapsed.count();
+    }
+    fmt::print("{:>9} {:>10.3f} {:>9.2f} {:>9.4f} {:>8.2f}%\n", ranks,
+               elapsed.count(), serial / elapsed.count(), stats[0].loss,
+               stats[0].accuracy * 100);
+  }
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <ugrad/engine.hpp>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// Builds `n` results of `op` from the same operands, then runs the local
+// backward of each one; reports the best ns per result of a few repetitions.
+static void bench(const char* name, size_t n,
+                  const std::function<ValuePtr(ValuePtr, ValuePtr)>& op) {
+  auto a = make_shared<Value>(0.75);
+  auto b = make_shared<Value>(1.25);
+  double forward_ns = 1e30, backward_ns = 1e30;
+  for (auto rep = 0; rep < 3; ++rep) {
+    vector<ValuePtr> outs;
+    outs.reserve(n);
+
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+      outs.push_back(op(a, b));
+    }
+    duration<double> forward = steady_clock::now() - start;
+
+    start = steady_clock::now();
+    for (auto& out : outs) {
+      // a composed op is a small graph, walk it like backward() would
+      for (auto& val : out->build_topo(true)) {
+        val->backward_step();
+      }
+    }
+    duration<double> backward = steady_clock::now() - start;
+
+    forward_ns = std::min(forward_ns, forward.count() * 1e9 / n);
+    backward_ns = std::min(backward_ns, backward.count() * 1e9 / n);
+  }
+  fmt::print("{:>28} {:>10.1f} {:>10.1f}\n", name, forward_ns, backward_ns);
+}
+
+int main(int argc, char* argv[]) {
+  size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+
+  fmt::print("{:>28} {:>10} {:>10}\n", "op (ns per result)", "forward",
+             "backward");
+  bench("a - b", n, [](ValuePtr a, ValuePtr b) { return a - b; });
+  bench("a + (-b), composed", n,
+        [](ValuePtr a, ValuePtr b) { return a + (-b); });
+  bench("a / b", n, [](ValuePtr a, ValuePtr b) { return a / b; });
+  bench("a * b^-1 via std::pow", n, [](ValuePtr a, ValuePtr b) {
+    return a * make_op(std::pow(b->data(), -1.0), Op::Pow, -1.0, b);
+  });
+  bench("-a", n, [](ValuePtr a, ValuePtr) { return -a; });
+  bench("a.exp()", n, [](ValuePtr a, ValuePtr) { return a->exp(); });
+  bench("a.log()", n, [](ValuePtr a, ValuePtr) { return a->log(); });
+  bench("a.tanh()", n, [](ValuePtr a, ValuePtr) { return a->tanh(); });
+  bench("a.sigmoid()", n, [](ValuePtr a, ValuePtr) { return a->sigmoid(); });
+  bench("a.pow(2), square", n, [](ValuePtr a, ValuePtr) { return a->pow(2); });
+  bench("a.pow(-1), reciprocal", n,
+        [](ValuePtr a, ValuePtr) { return a->pow(-1); });
+  bench("a.pow(0.5), sqrt", n, [](ValuePtr a, ValuePtr) { return a->pow(0.5); });
+  bench("a.pow(3), std::pow", n, [](ValuePtr a, ValuePtr) { return a->pow(3); });
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <ugrad/engine.hpp>
+#include <ugrad/nn.hpp>
+
+using namespace ugrad;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+// One sample through an MLP with wide hidden layers: every neuron is an
+// independent dot-product subgraph, which is what the parallel sweep spreads.
+constexpr size_t in_nr = 256;
+constexpr size_t width = 512;
+constexpr int reps = 5;
+
+// best of `reps` sweeps, grads of the whole graph reset before each
+template <typename Sweep>
+static double best_ms(const ValuePtr& root, Sweep&& sweep) {
+  auto nodes = root->build_topo();
+  auto best = 1e30;
+  for (auto rep = 0; rep < reps; ++rep) {
+    for (auto& val : nodes) {
+      val->set_grad(0.0);
+    }
+    auto start = steady_clock::now();
+    sweep();
+    duration<double> elapsed = steady_clock::now() - start;
+    best = std::min(best, elapsed.count() * 1e3);
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  size_t max_threads = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                : std::thread::hardware_concurrency();
+  max_threads = std::max<size_t>(max_threads, 1);
+
+  auto model = MLP(in_nr, {width, width, 1});
+  vector<ValuePtr> x;
+  for (size_t i = 0; i < in_nr; ++i) {
+    x.push_back(make_shared<Value>(i * 0.01, false));
+  }
+  auto loss = model(x)[0]->pow(2.0);
+  fmt::print("MLP({}, [{}, {}, 1]), {} nodes requiring grad\n", in_nr, width,
+             width, loss->build_topo(true).size());
+
+  auto serial = best_ms(loss, [&] { loss->backward(); });
+  fmt::print("{:>8} {:>12} {:>9}\n", "threads", "backward ms", "speedup");
+  fmt::print("{:>8} {:>12.3f} {:>9}\n", "serial", serial, "1.00");
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    ThreadPool pool{threads};
+    auto parallel = best_ms(loss, [&] { loss->backward(pool); });
+    fmt::print("{:>8} {:>12.3f} {:>9.2f}\n", threads, parallel,
+               serial / parallel);
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;
+    }
+  }
+  return 0;
+}
@@ -1,21 +1,24 @@
 #include <fmt/core.h>
 #include <fmt/ostream.h>
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <tuple>
 #include <ugrad/engine.hpp>
 #include <ugrad/nn.hpp>
+#include <ugrad/loss.hpp>
+#include <ugrad/optim.hpp>
 #include <algorithm>
-#include <numeric>
 
 using std::ifstream;
 using std::tuple;
 
 using namespace ugrad;
 
-static vector<vector<ValuePtr>> read_dataset_x(const char* xfile) {
-  vector<vector<ValuePtr>> X;
+// the samples as one [size x 2] tensor
+static ValuePtr read_dataset_x(const char* xfile) {
+  vector<double> X;
   ifstream xstr(xfile);
   if (!xstr.is_open()) {
     fmt::print("failed to open {} file\n", xfile);
@@ -24,14 +27,19 @@ static vector<vector<ValuePtr>> read_dataset_x(const char* xfile) {
 
   double x1, x2;
   while (xstr >> x1 >> x2) {
-    X.emplace_back(
-        vector<ValuePtr>{make_shared<Value>(x1), make_shared<Value>(x2)});
+    X.push_back(x1);
+    X.push_back(x2);
   }
-  return X;
+  if (X.empty()) {
+    return {};
+  }
+  auto rows = X.size() / 2;
+  return make_tensor(rows, 2, std::move(X), false);
 }
 
-static vector<vector<ValuePtr>> read_dataset_y(const char* yfile) {
-  vector<vector<ValuePtr>> y;
+// the labels, -1 or 1, as one [size x 1] tensor
+static ValuePtr read_dataset_y(const char* yfile) {
+  vector<double> y;
   ifstream ystr(yfile);
   if (!ystr.is_open()) {
     fmt::print("failed to open {} file\n", yfile);
@@ -40,59 +48,42 @@ static vector<vector<ValuePtr>> read_dataset_y(const char* yfile) {
 
   double y1;
   while (ystr >> y1) {
-    y.emplace_back(vector<ValuePtr>{make_shared<Value>(y1)});
+    y.push_back(y1);
+  }
+  if (y.empty()) {
+    return {};
   }
-  return y;
+  auto rows = y.size();
+  return make_tensor(rows, 1, std::move(y), false);
 }
 
-static tuple<vector<vector<ValuePtr>>, vector<vector<ValuePtr>>> read_dataset(
+static tuple<ValuePtr, ValuePtr> read_dataset(
     const char* xfile, const char* yfile) {
   auto X = read_dataset_x(xfile);
-  if (X.empty()) {
+  if (!X) {
     return {};
   }
   auto y = read_dataset_y(yfile);
-  if (y.empty()) {
+  if (!y) {
     return {};
   }
   return std::make_tuple(X, y);
 }
 
-static vector<vector<ValuePtr>> forward(MLP& model,
-                                        const vector<vector<ValuePtr>>& inputs) {
-  vector<vector<ValuePtr>> scores;
-  for (auto input : inputs) {
-    scores.emplace_back(model(input));
-  }
-  return scores;
+// the whole dataset as one batch, a [size x 1] tensor of scores
+static ValuePtr forward(MLP& model, const ValuePtr& inputs) {
+  return model(inputs);
 }
 
-static tuple<ValuePtr, double> loss(const vector<vector<ValuePtr>>& scores,
-                                    const vector<vector<ValuePtr>> y,
-                                    const vector<ValuePtr>& parameters) {
-  vector<ValuePtr> losses;
-  for (auto i = 0; i < y.size(); ++i) {
-    // fmt::print("scores[{}]: {:.6f}, y[{}]: {}\n", i, scores[i][0]->data(), i, y[i][0]->data());
-    losses.emplace_back(
-        (make_shared<Value>(1.0) + (-y[i][0]) * scores[i][0])->relu());
-  }
-  // svm "max-margin" loss
-  auto data_loss = std::accumulate(losses.begin(), losses.end(), make_shared<Value>(0.0));
-  data_loss = data_loss / make_shared<Value>(losses.size());
+static tuple<ValuePtr, double> compute_loss(const ValuePtr& scores,
+                                            const ValuePtr& y,
+                                            const ParameterView& parameters) {
+  // svm "max-margin" loss, with the accuracy of the scores
+  auto [data_loss, accuracy] = loss::hinge(scores, y);
 
   // L2 regularization
-  auto alpha = make_shared<Value>(1e-4);
-  auto square_sum = std::inner_product(parameters.begin(), parameters.end(),
-    parameters.begin(), make_shared<Value>(0.0));
-  auto reg_loss = alpha * square_sum;
+  auto reg_loss = l2_penalty(parameters, 1e-4);
   auto total_loss = data_loss + reg_loss;
-
-  // get accuracy
-  double accuracy = 0.0;
-  for (auto i = 0; i < y.size(); ++i) {
-    accuracy += (scores[i][0]->data() > 0) == (y[i][0]->data() > 0);
-  }
-  accuracy /= y.size();
   return std::make_tuple(total_loss, accuracy);
 }
 
@@ -103,33 +94,34 @@ int main(int argc, char* argv[]) {
   }
 
   auto [X, y] = read_dataset(argv[1], argv[2]);
-  fmt::print("read dataset finished, size of X: {}, size of y: {}\n", X.size(),
-             y.size());
+  fmt::print("read dataset finished, size of X: {}, size of y: {}\n", X->tensor().rows(),
+             y->tensor().rows());
 
   auto model = MLP(2, {16, 16, 1});
   fmt::print("model: {}\n", model);
-  fmt::print("number of parameters: {}\n", model.parameters().size());
+  fmt::print("number of parameters: {}\n", model.parameters().numel());
 
   const size_t epochs = 100;
+  optim::SGD optimizer{model.parameters(), 1.0};
+  auto start = std::chrono::steady_clock::now();
   for (auto epoch = 0; epoch < epochs; ++epoch) {
     auto scores = forward(model, X);
-    auto [total_loss, acc] = loss(scores, y, model.parameters());
+    auto [total_loss, acc] = compute_loss(scores, y, model.parameters());
     // fmt::print("total loss: {}, accuracy: {}\n", *total_loss, acc);
 
-    model.zero_grad();
+    optimizer.zero_grad();
     total_loss->backward();
 
     double learning_rate = 1.0 - 0.9 * epoch / 100;
     learning_rate = std::max(learning_rate, 0.001);
-    for (auto p : model.parameters()) {
-      // fmt::print("++ p->data: {:.6f}, p->grad: {:.6f}\n", p->data(), p->grad());
-      p->_data -= learning_rate * p->grad();
-      // fmt::print("-- p->data: {:.6f}, p->grad: {:.6f}\n", p->data(), p->grad());
-    }
+    optimizer.set_lr(learning_rate);
+    optimizer.step();
 
     fmt::print("epoch {} loss {}, accuracy {:.2f}%, lr: {:.4f}\n", epoch, total_loss->data(),
                acc * 100, learning_rate);
   }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  fmt::print("{} epochs in {:.3f}s\n", epochs, elapsed.count());
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include <fmt/core.h>
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <ugrad/tape.hpp>
+#include <vector>
+
+using std::ifstream;
+using std::vector;
+using namespace ugrad::tape;
+
+// the moons model of mlp_example, with every parameter a leaf at the bottom
+// of the tape, below the graph a Capture records and replays
+struct TapeMLP {
+  TapeMLP(Tape& tape, size_t in_nr, vector<size_t> outs_nr) {
+    std::mt19937 rng(std::random_device{}());
+    std::uniform_real_distribution<> dist{-1.0, 1.0};
+    for (auto out_nr : outs_nr) {
+      _shapes.push_back({in_nr, out_nr});
+      for (auto i = 0; i < out_nr * (in_nr + 1); ++i) {
+        _params.push_back(tape.var(i % (in_nr + 1) == in_nr ? 0.0 : dist(rng)));
+      }
+      in_nr = out_nr;
+    }
+  }
+
+  Var operator()(vector<Var> x) const {
+    auto param = _params.begin();
+    for (auto l = 0; l < _shapes.size(); ++l) {
+      auto [in_nr, out_nr] = _shapes[l];
+      vector<Var> out;
+      for (auto n = 0; n < out_nr; ++n) {
+        auto act = x[0] * *param++;
+        for (auto i = 1; i < in_nr; ++i) {
+          act = act + x[i] * *param++;
+        }
+        act = act + *param++;
+        out.push_back(l + 1 == _shapes.size() ? act : act.relu());
+      }
+      x = out;
+    }
+    return x[0];
+  }
+
+  vector<std::pair<size_t, size_t>> _shapes;
+  vector<Var> _params;
+};
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    fmt::print("Usage: tape_mlp_example X.txt y.txt\n");
+    return -1;
+  }
+
+  vector<std::pair<double, double>> X;
+  vector<double> y;
+  ifstream xstr(argv[1]), ystr(argv[2]);
+  double x1, x2, y1;
+  while (xstr >> x1 >> x2) {
+    X.emplace_back(x1, x2);
+  }
+  while (ystr >> y1) {
+    y.push_back(y1);
+  }
+  fmt::print("read dataset finished, size of X: {}, size of y: {}\n", X.size(),
+             y.size());
+
+  Tape tape;
+  auto model = TapeMLP(tape, 2, {16, 16, 1});
+  fmt::print("number of parameters: {}\n", model._params.size());
+
+  // every epoch builds the same graph, so it is recorded once and replayed
+  auto capture = Capture(tape);
+  double accuracy = 0.0;
+  auto step = [&]() {
+    auto data_loss = tape.var(0.0);
+    accuracy = 0.0;
+    for (auto i = 0; i < X.size(); ++i) {
+      auto score = model({tape.var(X[i].first), tape.var(X[i].second)});
+      // svm "max-margin" loss
+      data_loss = data_loss + (1.0 + (-y[i]) * score).relu();
+      accuracy += (score.data() > 0) == (y[i] > 0);
+    }
+    data_loss = data_loss / static_cast<double>(X.size());
+    accuracy /= X.size();
+
+    // L2 regularization
+    auto square_sum = tape.var(0.0);
+    for (auto p : model._params) {
+      square_sum = square_sum + p * p;
+    }
+    return data_loss + 1e-4 * square_sum;
+  };
+
+  const size_t epochs = 100;
+  auto start = std::chrono::steady_clock::now();
+  for (auto epoch = 0; epoch < epochs; ++epoch) {
+    auto total_loss = capture.run(step);
+
+    tape.zero_grad();
+    total_loss.backward();
+
+    double learning_rate = 1.0 - 0.9 * epoch / 100;
+    learning_rate = std::max(learning_rate, 0.001);
+    for (auto p : model._params) {
+      p.set_data(p.data() - learning_rate * p.grad());
+    }
+
+    fmt::print("epoch {} loss {}, accuracy {:.2f}%, lr: {:.4f}, nodes: {}\n",
+               epoch, total_loss.data(), accuracy * 100, learning_rate,
+               tape.size());
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  fmt::print("{} epochs in {:.3f}s, graph recorded {} time(s)\n", epochs,
+             elapsed.count(), capture.records());
+
+  return 0;
+}
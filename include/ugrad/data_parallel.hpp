@@ -0,0 +1,309 @@
+#ifndef __UGRAD_DATA_PARALLEL_HPP__
+#define __UGRAD_DATA_PARALLEL_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ugrad/loss.hpp>
+#include <ugrad/nn.hpp>
+#include <ugrad/optim.hpp>
+#include <ugrad/simd.hpp>
+#include <ugrad/thread_pool.hpp>
+
+namespace ugrad {
+
+// Barrier of a fixed number of threads, which yield until the last one
+// arrives. Reusable: the generation tells the rounds apart.
+class SpinBarrier {
+ public:
+  explicit SpinBarrier(size_t count) : _count{count} {}
+  SpinBarrier(const SpinBarrier&) = delete;
+  SpinBarrier& operator=(const SpinBarrier&) = delete;
+
+  void arrive_and_wait() {
+    auto generation = _generation.load(std::memory_order_acquire);
+    if (_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == _count) {
+      _arrived.store(0, std::memory_order_relaxed);
+      _generation.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    while (_generation.load(std::memory_order_acquire) == generation) {
+      std::this_thread::yield();
+    }
+  }
+
+ private:
+  size_t _count;
+  std::atomic<size_t> _arrived{0};
+  std::atomic<size_t> _generation{0};
+};
+
+// Ring collectives over one array of doubles per rank, called by all `ranks`
+// ranks at once, each with its own index. The range [begin, end) is cut into
+// one chunk per rank and every step moves one chunk between neighbours, from
+// rank r - 1 to rank r, followed by a barrier. The Barrier only needs
+// arrive_and_wait().
+
+// first entry of chunk c of [begin, end)
+inline size_t ring_chunk(size_t begin, size_t end, size_t ranks, size_t c) {
+  return begin + (end - begin) * c / ranks;
+}
+
+// Adds the chunks around the ring in ranks - 1 steps, after which rank r
+// holds the sum over all ranks of chunk (r + 1) % ranks.
+template <typename Barrier>
+void ring_reduce_scatter(double* const* buffers, size_t begin, size_t end,
+                         size_t rank, size_t ranks, Barrier& barrier) {
+  auto left = buffers[(rank + ranks - 1) % ranks];
+  auto own = buffers[rank];
+  for (size_t step = 0; step + 1 < ranks; ++step) {
+    auto c = (rank + 2 * ranks - 1 - step) % ranks;
+    auto first = ring_chunk(begin, end, ranks, c);
+    auto last = ring_chunk(begin, end, ranks, c + 1);
+    axpy(last - first, 1.0, left + first, own + first);
+    barrier.arrive_and_wait();
+  }
+}
+
+// Copies the summed chunks of a reduce-scatter around the ring in ranks - 1
+// steps, after which every rank holds every sum.
+template <typename Barrier>
+void ring_all_gather(double* const* buffers, size_t begin, size_t end,
+                     size_t rank, size_t ranks, Barrier& barrier) {
+  auto left = buffers[(rank + ranks - 1) % ranks];
+  auto own = buffers[rank];
+  for (size_t step = 0; step + 1 < ranks; ++step) {
+    auto c = (rank + ranks - step) % ranks;
+    auto first = ring_chunk(begin, end, ranks, c);
+    auto last = ring_chunk(begin, end, ranks, c + 1);
+    std::memcpy(own + first, left + first, (last - first) * sizeof(double));
+    barrier.arrive_and_wait();
+  }
+}
+
+// entries all-reduced per round, the chunks of a bucket stay in cache
+constexpr size_t kAllReduceBucket = size_t{1} << 16;
+
+// Replaces the first n entries of every buffer by their sum over the ranks.
+// Each rank reads and writes 2 (ranks - 1) / ranks of the array, and all
+// ranks end up with the same bits, as every sum is computed once.
+template <typename Barrier>
+void ring_all_reduce(double* const* buffers, size_t n, size_t rank,
+                     size_t ranks, Barrier& barrier,
+                     size_t bucket = kAllReduceBucket) {
+  for (size_t begin = 0; begin < n; begin += bucket) {
+    auto end = std::min(n, begin + bucket);
+    ring_reduce_scatter(buffers, begin, end, rank, ranks, barrier);
+    ring_all_gather(buffers, begin, end, rank, ranks, barrier);
+  }
+}
+
+using LossFn = std::function<loss::Result(const ValuePtr& scores,
+                                          const ValuePtr& targets)>;
+
+// mean loss and accuracy over the rows of a step or an epoch
+struct TrainStats {
+  double loss = 0.0;
+  double accuracy = 0.0;
+};
+
+// rows [begin, end) of t as a tensor node without grad
+inline ValuePtr slice_rows(const Tensor& t, size_t begin, size_t end) {
+  auto first = t.data() + begin * t.cols();
+  return make_tensor(end - begin, t.cols(),
+                     vector<double>(first, first + (end - begin) * t.cols()),
+                     false);
+}
+
+// Forward and backward of the share of `rank` out of `ranks` of the rows
+// [begin, end) of x and y. The shard's loss is weighted by its rows, so its
+// grads and stats sum over the ranks to those of the whole batch. Adds into
+// the grads of the model, zeroed by the caller.
+inline TrainStats shard_backward(MLP& model, const LossFn& loss_fn,
+                                 const Tensor& x, const Tensor& y,
+                                 size_t begin, size_t end, size_t rank,
+                                 size_t ranks) {
+  auto rows = end - begin;
+  auto first = begin + rows * rank / ranks;
+  auto last = begin + rows * (rank + 1) / ranks;
+  if (first == last) {
+    return {};
+  }
+  auto result =
+      loss_fn(model(slice_rows(x, first, last)), slice_rows(y, first, last));
+  auto weight = static_cast<double>(last - first) / rows;
+  (result.loss * weight)->backward();
+  return {weight * result.loss->data(), weight * result.accuracy};
+}
+
+// Synchronous data-parallel training of an MLP on `workers` threads, the
+// calling thread being the first. Every worker owns a replica of the model
+// and an optimizer; replicas start from the weights of the first one. A step
+// shards the minibatch by rows, runs forward and backward of each shard on
+// its replica, sums the flat grad buffers with a ring all-reduce and lets
+// every worker apply the same update, so the replicas stay identical. The
+// kernels of a worker run inline on it (see PoolScope).
+class DataParallelTrainer {
+ public:
+  using OptimizerFactory =
+      std::function<std::unique_ptr<optim::Optimizer>(ParameterView)>;
+  using Stats = TrainStats;
+
+  DataParallelTrainer(size_t workers, size_t in_nr, vector<size_t> outs_nr,
+                      LayerKind kind, const OptimizerFactory& make_optimizer,
+                      LossFn loss_fn = loss::hinge)
+      : _barrier{workers}, _loss{std::move(loss_fn)} {
+    assert(workers > 0);
+    for (size_t rank = 0; rank < workers; ++rank) {
+      _replicas.push_back(std::make_unique<Replica>(in_nr, outs_nr, kind));
+      auto& replica = *_replicas.back();
+      auto params = replica._model.parameters();
+      if (rank > 0) {
+        auto first = _replicas[0]->_model.parameters();
+        std::memcpy(params.data(), first.data(),
+                    params.numel() * sizeof(double));
+      }
+      replica._optimizer = make_optimizer(params);
+      _grads.push_back(params.grad());
+    }
+    for (size_t rank = 1; rank < workers; ++rank) {
+      _threads.emplace_back([this, rank] { work(rank); });
+    }
+  }
+
+  ~DataParallelTrainer() {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  DataParallelTrainer(const DataParallelTrainer&) = delete;
+  DataParallelTrainer& operator=(const DataParallelTrainer&) = delete;
+
+  size_t workers() const { return _replicas.size(); }
+  MLP& model(size_t rank = 0) { return _replicas[rank]->_model; }
+  optim::Optimizer& optimizer(size_t rank = 0) {
+    return *_replicas[rank]->_optimizer;
+  }
+  void set_lr(double lr) {
+    for (auto& replica : _replicas) {
+      replica->_optimizer->set_lr(lr);
+    }
+  }
+
+  // One step on the rows [begin, end) of the samples x and the targets y.
+  Stats step(const Tensor& x, const Tensor& y, size_t begin, size_t end) {
+    assert(x.rows() == y.rows() && begin < end && end <= x.rows());
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _job = {&x, &y, begin, end};
+      _done = 0;
+      ++_generation;
+    }
+    _wake.notify_all();
+    run(0);
+    std::unique_lock<std::mutex> lock{_mutex};
+    _finished.wait(lock, [this] { return _done + 1 == workers(); });
+    Stats stats;
+    for (auto& replica : _replicas) {
+      stats.loss += replica->_stats.loss;
+      stats.accuracy += replica->_stats.accuracy;
+    }
+    return stats;
+  }
+
+  // One pass over all rows in minibatches of `batch` rows.
+  Stats epoch(const Tensor& x, const Tensor& y, size_t batch) {
+    Stats stats;
+    for (size_t begin = 0; begin < x.rows(); begin += batch) {
+      auto end = std::min(x.rows(), begin + batch);
+      auto step_stats = step(x, y, begin, end);
+      auto weight = static_cast<double>(end - begin) / x.rows();
+      stats.loss += weight * step_stats.loss;
+      stats.accuracy += weight * step_stats.accuracy;
+    }
+    return stats;
+  }
+
+ private:
+  struct Replica {
+    Replica(size_t in_nr, const vector<size_t>& outs_nr, LayerKind kind)
+        : _model{in_nr, outs_nr, kind} {}
+
+    MLP _model;
+    std::unique_ptr<optim::Optimizer> _optimizer;
+    ThreadPool _serial{1};
+    // this shard's share of the step's loss and accuracy
+    Stats _stats;
+  };
+
+  struct Job {
+    const Tensor* _x = nullptr;
+    const Tensor* _y = nullptr;
+    size_t _begin = 0;
+    size_t _end = 0;
+  };
+
+  void run(size_t rank) {
+    auto& replica = *_replicas[rank];
+    PoolScope scope{replica._serial};
+    auto ranks = workers();
+    replica._optimizer->zero_grad();
+    replica._stats = shard_backward(replica._model, _loss, *_job._x, *_job._y,
+                                    _job._begin, _job._end, rank, ranks);
+    _barrier.arrive_and_wait();
+    ring_all_reduce(_grads.data(), replica._model.parameters().numel(), rank,
+                    ranks, _barrier);
+    replica._optimizer->step();
+  }
+
+  void work(size_t rank) {
+    size_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _wake.wait(lock, [&] { return _stop || _generation != seen; });
+        if (_stop) {
+          return;
+        }
+        seen = _generation;
+      }
+      run(rank);
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        ++_done;
+      }
+      _finished.notify_one();
+    }
+  }
+
+  vector<std::unique_ptr<Replica>> _replicas;
+  vector<double*> _grads;
+  SpinBarrier _barrier;
+  LossFn _loss;
+  vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _finished;
+  Job _job;
+  size_t _generation = 0;
+  size_t _done = 0;
+  bool _stop = false;
+};
+
+}  // namespace ugrad
+#endif  // __UGRAD_DATA_PARALLEL_HPP__
@@ -2,33 +2,350 @@
 #define __UGRAD_ENGINE_HPP__
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
 #include <cmath>
-#include <functional>
+#include <condition_variable>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <ugrad/handle.hpp>
+#include <ugrad/pool.hpp>
+#include <ugrad/simd.hpp>
+#include <ugrad/tensor.hpp>
+#include <ugrad/thread_pool.hpp>
+#include <ugrad/visit_set.hpp>
+
 namespace ugrad {
 
-using std::make_shared;
 using std::ostream;
 using std::shared_ptr;
 using std::vector;
 
 struct Value;
+
+// UGRAD_INTRUSIVE_PTR swaps shared_ptr for the intrusive, non-atomic Ref
+// handle backed by the slab allocator. Graphs must then be built, used and
+// released by a single thread; make_shared<Value> keeps working either way.
+#ifdef UGRAD_INTRUSIVE_PTR
+using ValuePtr = Ref<Value>;
+using ValueBase = RefCounted<Value>;
+
+template <typename T, typename... Args>
+Ref<T> make_shared(Args&&... args) {
+  return make_ref<T>(std::forward<Args>(args)...);
+}
+
+// slab blocks are recycled already
+template <typename T, typename... Args>
+Ref<T> make_pooled(Args&&... args) {
+  return make_ref<T>(std::forward<Args>(args)...);
+}
+#else
 using ValuePtr = shared_ptr<Value>;
+using ValueBase = std::enable_shared_from_this<Value>;
+using std::make_shared;
+
+template <typename T, typename... Args>
+shared_ptr<T> make_pooled(Args&&... args) {
+  return std::allocate_shared<T>(PoolAllocator<T>{},
+                                 std::forward<Args>(args)...);
+}
+#endif
+
+// Allocates a node with whichever handle ValuePtr is. Unlike an unqualified
+// make_shared it cannot be confused with std::make_shared by ADL on vector
+// arguments.
+template <typename... Args>
+ValuePtr make_value(Args&&... args) {
+#ifdef UGRAD_INTRUSIVE_PTR
+  return make_ref<Value>(std::forward<Args>(args)...);
+#else
+  return std::make_shared<Value>(std::forward<Args>(args)...);
+#endif
+}
+
+// Every node records which op produced it, backward dispatches on that code
+// instead of calling a per-node closure. Codes from Op::Custom upwards belong
+// to ops registered at runtime through register_op().
+// Ops suffixed Const take their constant operand from Value::_aux instead of
+// a child node. MatMul to Stack produce tensor nodes, TensorSum and Element
+// reduce a tensor child to a scalar, Neuron combines a tensor of weights with
+// scalar inputs. Hinge to SoftmaxCrossEntropy are the batched losses of
+// loss.hpp, scalar nodes of a tensor of scores and a tensor of targets.
+enum class Op : uint8_t {
+  Leaf, Add, Sub, Mul, Div, Pow, Square, Reciprocal, Sqrt,
+  Relu, Neg, Exp, Log, Tanh, Sigmoid, Sum, Dot,
+  AddConst, RSubConst, MulConst, DivConst, RDivConst,
+  MatMul, Linear, LinearRelu, Dense, TensorRelu, Stack, TensorSum, Element,
+  Neuron, L2Penalty, Hinge, Mse, Logistic, SoftmaxCrossEntropy, Custom
+};
+
+// Backward of a user-defined op: reads out.grad() and accumulates into the
+// grads of out.children(). Plain function pointers keep nodes closure-free.
+using BackwardFn = void (*)(Value& out);
+
+// One slot per code from Op::Custom up. The slots never move, so ops can be
+// registered on one thread while another runs a backward.
+inline std::array<std::atomic<BackwardFn>,
+                  256 - static_cast<size_t>(Op::Custom)>&
+custom_ops() {
+  static std::array<std::atomic<BackwardFn>,
+                    256 - static_cast<size_t>(Op::Custom)>
+      ops{};
+  return ops;
+}
+
+// Throws std::length_error once every code up to 255 is taken.
+inline Op register_op(BackwardFn backward) {
+  static std::atomic<size_t> count{0};
+  auto& ops = custom_ops();
+  auto index = count.fetch_add(1, std::memory_order_relaxed);
+  if (index >= ops.size()) {
+    throw std::length_error("ugrad: no op codes left to register");
+  }
+  ops[index].store(backward, std::memory_order_release);
+  return static_cast<Op>(static_cast<size_t>(Op::Custom) + index);
+}
+
+// How backward adds into the grads of leaves. Concurrent backward() calls on
+// graphs that share leaves, e.g. per-sample graphs of one model on several
+// threads, need Atomic, which adds with a compare-and-swap loop, or Sharded,
+// which collects each thread's leaf grads in its own GradShard, merged after
+// the threads are done. Interior nodes belong to a single graph and are only
+// updated atomically under Atomic, which is what the parallel backward runs
+// its steps in.
+enum class Accumulation : uint8_t { Plain, Atomic, Sharded };
+
+// Whether ops record the graph for backward and how its leaf grads are
+// accumulated. Both are thread-local, toggled through NoGradGuard,
+// AtomicGradGuard and ShardedGradGuard.
+struct GradMode {
+  static bool is_enabled() { return enabled(); }
+  static void set_enabled(bool status) { enabled() = status; }
+  static Accumulation accumulation() { return accumulation_mode(); }
+  static void set_accumulation(Accumulation mode) { accumulation_mode() = mode; }
+
+ private:
+  static bool& enabled() {
+    static thread_local bool status = true;
+    return status;
+  }
+  static Accumulation& accumulation_mode() {
+    static thread_local Accumulation mode = Accumulation::Plain;
+    return mode;
+  }
+};
+
+// target += value as one atomic read-modify-write
+inline void atomic_add(double& target, double value) {
+  double expected, desired;
+  __atomic_load(&target, &expected, __ATOMIC_RELAXED);
+  do {
+    desired = expected + value;
+  } while (!__atomic_compare_exchange(&target, &expected, &desired, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// 1 / (1 + exp(-z)), the branches keep std::exp from overflowing for large |z|
+inline double stable_sigmoid(double z) {
+  return z >= 0 ? 1.0 / (1.0 + std::exp(-z))
+                : std::exp(z) / (1.0 + std::exp(z));
+}
+
+// log of the sum of exp over n values, shifted by their max so exp cannot
+// overflow
+inline double log_sum_exp(const double* x, size_t n) {
+  auto max = *std::max_element(x, x + n);
+  double sum = 0.0;
+  for (size_t j = 0; j < n; ++j) {
+    sum += std::exp(x[j] - max);
+  }
+  return max + std::log(sum);
+}
+
+// Accumulates leaf grads atomically for its scope.
+class AtomicGradGuard {
+ public:
+  AtomicGradGuard() : _prev{GradMode::accumulation()} {
+    GradMode::set_accumulation(Accumulation::Atomic);
+  }
+  ~AtomicGradGuard() { GradMode::set_accumulation(_prev); }
+  AtomicGradGuard(const AtomicGradGuard&) = delete;
+  AtomicGradGuard& operator=(const AtomicGradGuard&) = delete;
+
+ private:
+  Accumulation _prev;
+};
+
+// Inference mode for its scope: ops only compute values, their results are
+// childless constants drawn from a node pool, no graph is recorded.
+class NoGradGuard {
+ public:
+  NoGradGuard() : _prev{GradMode::is_enabled()} { GradMode::set_enabled(false); }
+  ~NoGradGuard() { GradMode::set_enabled(_prev); }
+  NoGradGuard(const NoGradGuard&) = delete;
+  NoGradGuard& operator=(const NoGradGuard&) = delete;
+
+ private:
+  bool _prev;
+};
+
+template <typename... Children>
+ValuePtr make_op(double data, Op op, double aux, const Children&... children);
+
+template <typename... Children>
+ValuePtr make_tensor_op(std::unique_ptr<Tensor> out, Op op,
+                        const Children&... children);
+
+// Tears dropped graphs down. A dying node hands its children to release()
+// instead of destroying them from inside its own destructor, which would
+// recurse once per level of the graph. release() walks them with an explicit
+// worklist and unlinks every node it holds the last handle to before letting
+// it go, so each destructor finds no children left and returns at once.
+// With deferred teardown the children are queued for a background thread
+// and the dropping thread, usually the training loop, does not wait for the
+// graph to be freed.
+class Reclaimer {
+ public:
+  static void release(vector<ValuePtr> nodes);
+
+  // Handing graphs to the background thread needs thread-safe reference
+  // counts, the intrusive handle always tears down on the dropping thread.
+  static void set_deferred(bool status) {
+#ifdef UGRAD_INTRUSIVE_PTR
+    assert(!status && "deferred teardown needs atomic reference counts");
+    (void)status;
+#else
+    if (status) {
+      worker();
+    }
+    deferred_flag() = status;
+#endif
+  }
+  static bool deferred() { return deferred_flag(); }
+
+  // blocks until everything queued so far has been freed
+  static void drain() {
+    if (deferred()) {
+      worker().drain();
+    }
+  }
+
+ private:
+  static void unlink(vector<ValuePtr>& worklist);
+
+  static std::atomic<bool>& deferred_flag() {
+    static std::atomic<bool> status{false};
+    return status;
+  }
+
+  class Worker {
+   public:
+    Worker() : _thread{[this] { run(); }} {}
+    ~Worker() {
+      // graphs dropped by later static destructors are freed in place
+      deferred_flag() = false;
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stop = true;
+      }
+      _wake.notify_one();
+      _thread.join();
+    }
+
+    void push(vector<ValuePtr> nodes) {
+      {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _queue.push_back(std::move(nodes));
+      }
+      _wake.notify_one();
+    }
 
-struct Value : public std::enable_shared_from_this<Value> {
+    void drain() {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _idle.wait(lock, [this] { return _queue.empty() && !_busy; });
+    }
+
+   private:
+    void run() {
+      std::unique_lock<std::mutex> lock{_mutex};
+      while (true) {
+        _wake.wait(lock, [this] { return _stop || !_queue.empty(); });
+        if (_queue.empty()) {
+          return;
+        }
+        auto batch = std::move(_queue);
+        _queue.clear();
+        _busy = true;
+        lock.unlock();
+        for (auto& nodes : batch) {
+          unlink(nodes);
+        }
+        lock.lock();
+        _busy = false;
+        _idle.notify_all();
+      }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    vector<vector<ValuePtr>> _queue;
+    bool _busy = false;
+    bool _stop = false;
+    std::thread _thread;
+  };
+
+  static Worker& worker() {
+    static Worker worker;
+    return worker;
+  }
+};
+
+struct Value : public ValueBase {
  public:
-  Value(double data)
-      : _data(data), _vis{false}, _grad(0.0f), _backward{[]() {}} {}
+  Value(double data, bool requires_grad = true)
+      : _data(data), _grad(0.0f), _aux(0.0), _requires_grad{requires_grad} {}
 
-  Value(double data, vector<ValuePtr> children)
+  // an op node needs a gradient iff one of its children does
+  Value(double data, vector<ValuePtr> children, Op op = Op::Leaf,
+        double aux = 0.0)
       : _data(data),
-        _vis{false},
         _grad(0.0f),
-        _children{children},
-        _backward{[]() {}} {}
+        _aux(aux),
+        _children{std::move(children)},
+        _op{op},
+        _requires_grad{std::any_of(
+            _children.begin(), _children.end(),
+            [](const ValuePtr& child) { return child->_requires_grad; })} {}
+
+  // Tensor nodes carry a row-major matrix instead of a scalar, `_data` and
+  // `_grad` stay unused.
+  Value(std::unique_ptr<Tensor> tensor, bool requires_grad = true)
+      : Value(0.0, requires_grad) {
+    _tensor = std::move(tensor);
+  }
+
+  Value(std::unique_ptr<Tensor> tensor, vector<ValuePtr> children, Op op,
+        double aux = 0.0)
+      : Value(0.0, std::move(children), op, aux) {
+    _tensor = std::move(tensor);
+  }
+
+  ~Value() {
+    if (!_children.empty()) {
+      Reclaimer::release(std::move(_children));
+    }
+  }
 
   double data() const { return _data; }
   void set_data(double data) { _data = data; }
@@ -36,133 +353,965 @@ struct Value : public std::enable_shared_from_this<Value> {
   void set_grad(double grad) { _grad = grad; }
   const vector<ValuePtr>& children() const { return _children; }
   void children(const vector<ValuePtr>& children) { _children = children; }
-  bool visited() { return _vis; }
-  void visited(bool status) { _vis = status; }
+  Op op() const { return _op; }
+  double aux() const { return _aux; }
+  bool requires_grad() const { return _requires_grad; }
+  void requires_grad(bool status) { _requires_grad = status; }
+  bool is_tensor() const { return _tensor != nullptr; }
+  Tensor& tensor() const { return *_tensor; }
 
-  ValuePtr relu() {
-    auto out = make_shared<Value>(std::max(0.0, _data),
-                                  vector<ValuePtr>{shared_from_this()});
-    out->_backward = [out, self = shared_from_this()]() {
-      self->_grad += (out->_data > 0) * out->_grad;
-    };
-    return out;
+  void zero_grad() {
+    _grad = 0.0;
+    if (_tensor) {
+      _tensor->zero_grad();
+    }
   }
 
-  ValuePtr pow(ValuePtr rhs) {
-    auto out = make_shared<Value>(std::pow(_data, rhs->_data),
-                                  vector<ValuePtr>{shared_from_this()});
-    out->_backward = [out, self = shared_from_this(), rhs]() {
-      self->_grad +=
-          rhs->_data * std::pow(self->_data, rhs->_data - 1) * out->_grad;
-    };
-    return out;
+  ValuePtr relu() {
+    if (_tensor) {
+      auto out = std::make_unique<Tensor>(_tensor->rows(), _tensor->cols());
+      for (size_t i = 0; i < out->size(); ++i) {
+        out->data()[i] = std::max(0.0, _tensor->data()[i]);
+      }
+      return make_tensor_op(std::move(out), Op::TensorRelu,
+                            shared_from_this());
+    }
+    return make_op(std::max(0.0, _data), Op::Relu, 0.0, shared_from_this());
   }
 
+  // the exponent is a constant of the node, no gradient flows into it
+  ValuePtr pow(ValuePtr rhs) { return pow(rhs->_data); }
+
+  // common exponents get nodes that avoid std::pow in forward and backward
   ValuePtr pow(double exp) {
-    auto rhs = make_shared<Value>(exp);
-    return pow(rhs);
+    auto self = shared_from_this();
+    if (exp == 2.0) {
+      return make_op(_data * _data, Op::Square, 0.0, self);
+    }
+    if (exp == -1.0) {
+      return make_op(1.0 / _data, Op::Reciprocal, 0.0, self);
+    }
+    if (exp == 0.5) {
+      return make_op(std::sqrt(_data), Op::Sqrt, 0.0, self);
+    }
+    return make_op(std::pow(_data, exp), Op::Pow, exp, self);
   }
 
-  void backward() {
-    _grad = 1.0;
-    auto topo_order = build_topo();
-    for (auto val : topo_order) {
-      val->_backward();
+  ValuePtr exp() {
+    return make_op(std::exp(_data), Op::Exp, 0.0, shared_from_this());
+  }
+
+  ValuePtr log() {
+    return make_op(std::log(_data), Op::Log, 0.0, shared_from_this());
+  }
+
+  ValuePtr tanh() {
+    return make_op(std::tanh(_data), Op::Tanh, 0.0, shared_from_this());
+  }
+
+  ValuePtr sigmoid() {
+    return make_op(stable_sigmoid(_data), Op::Sigmoid, 0.0,
+                   shared_from_this());
+  }
+
+  // Children that do not require grad keep a zero grad. Leaves may be shared
+  // with concurrent backward() calls and follow GradMode, so does every node
+  // under Accumulation::Atomic.
+  static void accumulate(const ValuePtr& child, double grad) {
+    if (!child->_requires_grad) {
+      return;
+    }
+    if (child->_op == Op::Leaf ||
+        GradMode::accumulation() == Accumulation::Atomic) {
+      accumulate_shared(*child, grad);
+    } else {
+      child->_grad += grad;
     }
   }
 
-  vector<ValuePtr> build_topo() {
-    vector<ValuePtr> topo_order;
-    build_topo(topo_order);
-    clear_visit_mark(topo_order);
-    return topo_order;
+  static void accumulate_shared(Value& node, double grad);
+
+  // Calls add(grad) with the grad array the tensor `child` accumulates into,
+  // following the same rules as accumulate(): under Atomic the tensor is
+  // locked for the call, under Sharded a leaf's grads go to the shard.
+  // An `add` that may wait on the pool (a threaded gemm) could run another
+  // step accumulating into the same tensor meanwhile, with `may_wait` it
+  // writes to a scratch array that is added under the lock afterwards.
+  template <typename Add>
+  static void accumulate_tensor(const ValuePtr& child, Add&& add,
+                                bool may_wait = false) {
+    if (!child->_requires_grad) {
+      return;
+    }
+    auto& tensor = *child->_tensor;
+    switch (GradMode::accumulation()) {
+      case Accumulation::Plain:
+        add(tensor.grad());
+        break;
+      case Accumulation::Atomic: {
+        if (!may_wait) {
+          std::lock_guard<std::mutex> lock{tensor._grad_mutex};
+          add(tensor.grad());
+          break;
+        }
+        vector<double> update(tensor.size());
+        add(update.data());
+        std::lock_guard<std::mutex> lock{tensor._grad_mutex};
+        for (size_t i = 0; i < update.size(); ++i) {
+          tensor.grad()[i] += update[i];
+        }
+        break;
+      }
+      case Accumulation::Sharded:
+        add(child->_op == Op::Leaf ? shard_grad(*child) : tensor.grad());
+        break;
+    }
+  }
+
+  static double* shard_grad(Value& leaf);
+
+  // the data of n scalar nodes copied to a contiguous per-thread array, valid
+  // until the next call on the same thread
+  static const double* gather(const ValuePtr* nodes, size_t n) {
+    static thread_local vector<double> values;
+    values.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = nodes[i]->_data;
+    }
+    return values.data();
   }
 
-  void build_topo(ValuePtr val, vector<ValuePtr>& topo_order) {
-    if (!val->visited()) {
-      val->visited(true);
-      for (auto child : val->children()) {
-        build_topo(child, topo_order);
+  // accumulates this node's grad into its children
+  void backward_step() {
+    switch (_op) {
+      case Op::Leaf:
+        break;
+      case Op::Add:
+        accumulate(_children[0], _grad);
+        accumulate(_children[1], _grad);
+        break;
+      case Op::Sub:
+        accumulate(_children[0], _grad);
+        accumulate(_children[1], -_grad);
+        break;
+      case Op::Mul:
+        accumulate(_children[0], _children[1]->_data * _grad);
+        accumulate(_children[1], _children[0]->_data * _grad);
+        break;
+      case Op::Pow:
+        accumulate(_children[0],
+                   _aux * std::pow(_children[0]->_data, _aux - 1) * _grad);
+        break;
+      case Op::Square:
+        accumulate(_children[0], 2.0 * _children[0]->_data * _grad);
+        break;
+      case Op::Reciprocal:
+        accumulate(_children[0], -_data * _data * _grad);
+        break;
+      case Op::Sqrt:
+        accumulate(_children[0], 0.5 * _grad / _data);
+        break;
+      case Op::Exp:
+        accumulate(_children[0], _data * _grad);
+        break;
+      case Op::Log:
+        accumulate(_children[0], _grad / _children[0]->_data);
+        break;
+      case Op::Tanh:
+        accumulate(_children[0], (1.0 - _data * _data) * _grad);
+        break;
+      case Op::Sigmoid:
+        accumulate(_children[0], _data * (1.0 - _data) * _grad);
+        break;
+      case Op::Relu:
+        accumulate(_children[0], (_data > 0) * _grad);
+        break;
+      case Op::Neg:
+        accumulate(_children[0], -_grad);
+        break;
+      case Op::Div:
+        accumulate(_children[0], _grad / _children[1]->_data);
+        accumulate(_children[1], -(_grad * _data / _children[1]->_data));
+        break;
+      case Op::Sum:
+        for (auto& child : _children) {
+          accumulate(child, _grad);
+        }
+        break;
+      case Op::AddConst:
+        accumulate(_children[0], _grad);
+        break;
+      case Op::RSubConst:
+        accumulate(_children[0], -_grad);
+        break;
+      case Op::MulConst:
+        accumulate(_children[0], _aux * _grad);
+        break;
+      case Op::DivConst:
+        accumulate(_children[0], _grad / _aux);
+        break;
+      case Op::RDivConst:
+        // d(c / x)/dx = -c / x^2 = -out / x
+        accumulate(_children[0], -(_grad * _data / _children[0]->_data));
+        break;
+      case Op::Dot: {
+        // children hold both operands back to back: lhs[0..n), rhs[0..n)
+        auto n = _children.size() / 2;
+        for (size_t i = 0; i < n; ++i) {
+          accumulate(_children[i], _children[n + i]->_data * _grad);
+          accumulate(_children[n + i], _children[i]->_data * _grad);
+        }
+        break;
       }
-      topo_order.insert(topo_order.begin(), val);
+      case Op::MatMul:
+      case Op::Linear:
+      case Op::LinearRelu:
+      case Op::Dense:
+      case Op::TensorRelu:
+      case Op::Stack:
+      case Op::TensorSum:
+      case Op::Element:
+      case Op::Neuron:
+      case Op::L2Penalty:
+        tensor_backward_step();
+        break;
+      case Op::Hinge:
+      case Op::Mse:
+      case Op::Logistic:
+      case Op::SoftmaxCrossEntropy:
+        loss_backward_step();
+        break;
+      default:
+        custom_ops()[static_cast<size_t>(_op) -
+                     static_cast<size_t>(Op::Custom)]
+            .load(std::memory_order_acquire)(*this);
+        break;
     }
   }
 
-  void build_topo(vector<ValuePtr>& topo_order) {
-    build_topo(shared_from_this(), topo_order);
+  void tensor_backward_step() {
+    switch (_op) {
+      case Op::MatMul:
+      case Op::Linear:
+      case Op::LinearRelu: {
+        // Y = X W (+ b): dX += dY W^T, dW += X^T dY, db += column sums of dY
+        auto& x = _children[0]->tensor();
+        auto& w = _children[1]->tensor();
+        auto batch = x.rows(), in = x.cols(), out = w.cols();
+        auto dy = _tensor->grad();
+        vector<double> masked;
+        if (_op == Op::LinearRelu) {
+          // through the fused relu first: dY where Y > 0
+          masked.resize(_tensor->size());
+          for (size_t i = 0; i < masked.size(); ++i) {
+            masked[i] = (_tensor->data()[i] > 0) * dy[i];
+          }
+          dy = masked.data();
+        }
+        accumulate_tensor(_children[0], [&](double* dx) {
+          gemm(false, true, batch, in, out, dy, w.data(), dx, true);
+        }, true);
+        accumulate_tensor(_children[1], [&](double* dw) {
+          gemm(true, false, in, out, batch, x.data(), dy, dw, true);
+        }, true);
+        if (_op != Op::MatMul) {
+          accumulate_tensor(_children[2], [&](double* db) {
+            for (size_t i = 0; i < batch; ++i) {
+              for (size_t j = 0; j < out; ++j) {
+                db[j] += dy[i * out + j];
+              }
+            }
+          });
+        }
+        break;
+      }
+      case Op::Dense:
+        dense_backward_step();
+        break;
+      case Op::TensorRelu:
+        accumulate_tensor(_children[0], [&](double* dx) {
+          for (size_t i = 0; i < _tensor->size(); ++i) {
+            dx[i] += (_tensor->data()[i] > 0) * _tensor->grad()[i];
+          }
+        });
+        break;
+      case Op::Stack:
+        for (size_t i = 0; i < _children.size(); ++i) {
+          accumulate(_children[i], _tensor->grad()[i]);
+        }
+        break;
+      case Op::TensorSum:
+        accumulate_tensor(_children[0], [&](double* dx) {
+          auto size = _children[0]->tensor().size();
+          for (size_t i = 0; i < size; ++i) {
+            dx[i] += _grad;
+          }
+        });
+        break;
+      case Op::Element:
+        accumulate_tensor(_children[0], [&](double* dx) {
+          dx[static_cast<size_t>(_aux)] += _grad;
+        });
+        break;
+      case Op::Neuron: {
+        // children: the [1 x (n + 1)] weights and bias, then the n inputs;
+        // a non-zero aux marks a fused relu
+        auto n = _children.size() - 1;
+        auto grad = _aux != 0.0 && _data <= 0.0 ? 0.0 : _grad;
+        if (grad == 0.0) {
+          break;
+        }
+        accumulate_tensor(_children[0], [&](double* dw) {
+          axpy(n, grad, gather(_children.data() + 1, n), dw);
+          dw[n] += grad;
+        });
+        auto w = _children[0]->tensor().data();
+        for (size_t i = 0; i < n; ++i) {
+          accumulate(_children[i + 1], grad * w[i]);
+        }
+        break;
+      }
+      case Op::L2Penalty: {
+        // aux * sum of p^2 over the tensor children: dp += 2 aux p dY, a
+        // single axpy when the tensors are one buffer, as a module's are
+        auto scale = 2.0 * _aux * _grad;
+        auto n = contiguous_size(_children);
+        if (n && GradMode::accumulation() == Accumulation::Plain) {
+          auto& first = _children[0]->tensor();
+          axpy(n, scale, first.data(), first.grad());
+          break;
+        }
+        for (auto& child : _children) {
+          auto& t = child->tensor();
+          accumulate_tensor(child, [&](double* dp) {
+            axpy(t.size(), scale, t.data(), dp);
+          });
+        }
+        break;
+      }
+      default:
+        break;
+    }
   }
 
-  void clear_visit_mark(vector<ValuePtr>& topo_order) {
+  // Y = X W^T + b with W the neuron rows stacked, see dense(); a non-zero aux
+  // marks a fused relu
+  void dense_backward_step() {
+    auto& x = _children[0]->tensor();
+    auto batch = x.rows(), in = x.cols(), out = _children.size() - 1;
+    auto dy = _tensor->grad();
+    vector<double> masked;
+    if (_aux != 0.0) {
+      masked.resize(_tensor->size());
+      for (size_t i = 0; i < masked.size(); ++i) {
+        masked[i] = (_tensor->data()[i] > 0) * dy[i];
+      }
+      dy = masked.data();
+    }
+    vector<double> w(out * in), bias(out);
+    stack_rows(_children.data() + 1, out, in, w.data(), bias.data());
+    // dX += dY W
+    accumulate_tensor(_children[0], [&](double* dx) {
+      gemm(false, false, batch, in, out, dy, w.data(), dx, true);
+    }, true);
+    // dW = dY^T X and db = column sums of dY, then added row by row
+    auto& dw = w;
+    gemm(true, false, out, in, batch, dy, x.data(), dw.data());
+    std::fill(bias.begin(), bias.end(), 0.0);
+    for (size_t i = 0; i < batch; ++i) {
+      axpy(out, 1.0, dy + i * out, bias.data());
+    }
+    for (size_t j = 0; j < out; ++j) {
+      accumulate_tensor(_children[j + 1], [&](double* grad) {
+        axpy(in, 1.0, dw.data() + j * in, grad);
+        grad[in] += bias[j];
+      });
+    }
+  }
+
+  // Closed-form grad of the scores, children[0], of a loss of loss.hpp, the
+  // mean over `size` terms; children[1] holds the targets.
+  void loss_backward_step() {
+    auto& s = _children[0]->tensor();
+    auto y = _children[1]->tensor().data();
+    auto rows = _op == Op::SoftmaxCrossEntropy ? s.rows() : s.size();
+    auto scale = _grad / static_cast<double>(rows);
+    accumulate_tensor(_children[0], [&](double* ds) {
+      switch (_op) {
+        case Op::Hinge:
+          // max(0, 1 - y s), with targets y of -1 or 1
+          for (size_t i = 0; i < s.size(); ++i) {
+            if (1.0 - y[i] * s.data()[i] > 0.0) {
+              ds[i] -= scale * y[i];
+            }
+          }
+          break;
+        case Op::Mse:
+          for (size_t i = 0; i < s.size(); ++i) {
+            ds[i] += 2.0 * scale * (s.data()[i] - y[i]);
+          }
+          break;
+        case Op::Logistic:
+          // log(1 + exp(-y s)), with targets y of -1 or 1
+          for (size_t i = 0; i < s.size(); ++i) {
+            ds[i] -= scale * y[i] * stable_sigmoid(-y[i] * s.data()[i]);
+          }
+          break;
+        default:
+          // dlogits = (softmax - one_hot(label)) / batch
+          for (size_t r = 0; r < s.rows(); ++r) {
+            auto row = s.data() + r * s.cols();
+            auto lse = log_sum_exp(row, s.cols());
+            auto label = static_cast<size_t>(y[r]);
+            for (size_t j = 0; j < s.cols(); ++j) {
+              auto p = std::exp(row[j] - lse) - (j == label ? 1.0 : 0.0);
+              ds[r * s.cols() + j] += scale * p;
+            }
+          }
+          break;
+      }
+    });
+  }
+
+  // total size of tensors laid out back to back that all take grads, else 0
+  static size_t contiguous_size(const vector<ValuePtr>& tensors) {
+    size_t n = 0;
+    for (auto& node : tensors) {
+      auto& t = node->tensor();
+      auto& first = tensors[0]->tensor();
+      if (!node->_requires_grad || t.data() != first.data() + n ||
+          t.grad() != first.grad() + n) {
+        return 0;
+      }
+      n += t.size();
+    }
+    return n;
+  }
+
+  // copies n [1 x (in + 1)] neuron rows into w [n x in] and their biases
+  static void stack_rows(const ValuePtr* rows, size_t n, size_t in, double* w,
+                         double* bias) {
+    for (size_t j = 0; j < n; ++j) {
+      auto row = rows[j]->tensor().data();
+      std::copy(row, row + in, w + j * in);
+      bias[j] = row[in];
+    }
+  }
+
+  void backward() {
+    assert(!_tensor && "backward() starts from a scalar");
+    _grad = 1.0;
+    auto topo_order = build_topo(true);
     for (auto& val : topo_order) {
-      val->_vis = false;
+      val->backward_step();
     }
   }
 
+  // Reverse sweep spread over the threads of `pool`. A node is ready once
+  // every node consuming it has run its backward step; each step counts down
+  // its children and the ones it releases run as new tasks, except the last
+  // one, which the same thread continues with. Grads are added atomically, so
+  // wide graphs (hundreds of neurons of a layer) are swept by all threads
+  // while a chain degenerates to the serial walk.
+  void backward(ThreadPool& pool) {
+    assert(!_tensor && "backward() starts from a scalar");
+    _grad = 1.0;
+    auto topo_order = build_topo(true);
+    // Leaves have no step to run, only op nodes are numbered. Node i feeds
+    // grads to op nodes edges[offsets[i]..offsets[i + 1]), every edge counts
+    // as one pending consumer of its child.
+    NodeIndex index;
+    for (auto& val : topo_order) {
+      if (val->_op != Op::Leaf) {
+        index.insert(val.get());
+      }
+    }
+    auto n = index.size();
+    vector<uint32_t> offsets(n + 1, 0);
+    vector<uint32_t> edges;
+    std::unique_ptr<std::atomic<uint32_t>[]> consumers{
+        new std::atomic<uint32_t>[n]};
+    for (size_t i = 0; i < n; ++i) {
+      consumers[i].store(0, std::memory_order_relaxed);
+    }
+    vector<Value*> nodes;
+    nodes.reserve(n);
+    for (auto& val : topo_order) {
+      if (val->_op == Op::Leaf) {
+        continue;
+      }
+      for (auto& child : val->_children) {
+        if (child->_requires_grad && child->_op != Op::Leaf) {
+          auto j = index.find(child.get());
+          edges.push_back(j);
+          consumers[j].fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      nodes.push_back(val.get());
+      offsets[nodes.size()] = static_cast<uint32_t>(edges.size());
+    }
+
+    TaskGroup group{pool};
+    auto step = [&](uint32_t i, auto& self) -> void {
+      AtomicGradGuard atomic;
+      while (i != NodeIndex::npos) {
+        nodes[i]->backward_step();
+        auto next = NodeIndex::npos;
+        for (auto e = offsets[i]; e < offsets[i + 1]; ++e) {
+          auto j = edges[e];
+          if (consumers[j].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            continue;
+          }
+          if (next != NodeIndex::npos) {
+            group.run([&self, next] { self(next, self); });
+          }
+          next = j;
+        }
+        i = next;
+      }
+    };
+    // the root comes first in topological order
+    if (n > 0) {
+      step(0, step);
+    }
+    group.wait();
+  }
+
+  // With `requires_grad_only` the order leaves out every subgraph that cannot
+  // reach a leaf requiring grad, which is all backward needs to visit. The
+  // visited marks live in the call, so threads may sort graphs that share
+  // nodes concurrently.
+  vector<ValuePtr> build_topo(bool requires_grad_only = false) {
+    vector<ValuePtr> topo_order;
+    VisitSet visited;
+    build_topo(shared_from_this(), topo_order, visited, requires_grad_only);
+    return topo_order;
+  }
+
+  // Depth-first post-order with an explicit stack instead of recursion, so
+  // deep chains (long unrolls, big accumulated sums) cannot overflow the call
+  // stack. Children are visited in order, matching the recursive formulation;
+  // the post-order is reversed once at the end, which keeps it O(n). Nodes
+  // already in `visited` are skipped, which lets several roots share one
+  // order.
+  static void build_topo(ValuePtr val, vector<ValuePtr>& topo_order,
+                         VisitSet& visited, bool requires_grad_only = false) {
+    if ((requires_grad_only && !val->_requires_grad) ||
+        !visited.insert(val.get())) {
+      return;
+    }
+    vector<ValuePtr> post_order;
+    vector<std::pair<const ValuePtr*, size_t>> stack{{&val, 0}};
+    while (!stack.empty()) {
+      auto& [node, next_child] = stack.back();
+      const auto& children = (*node)->children();
+      if (next_child < children.size()) {
+        const auto& child = children[next_child++];
+        if ((!requires_grad_only || child->_requires_grad) &&
+            visited.insert(child.get())) {
+          stack.emplace_back(&child, 0);
+        }
+      } else {
+        post_order.push_back(*node);
+        stack.pop_back();
+      }
+    }
+    topo_order.insert(topo_order.begin(), post_order.rbegin(),
+                      post_order.rend());
+  }
+
   friend ostream& operator<<(ostream& os, const Value& val) {
+    if (val._tensor) {
+      os << "Tensor(rows=" << val._tensor->rows()
+         << ", cols=" << val._tensor->cols() << ")";
+      return os;
+    }
     os << "Value(data=" << val._data << ", grad=" << val._grad << ")";
     return os;
   }
 
   double _data;
-  bool _vis;
   double _grad;
+  // constant operand of the op, e.g. the exponent of Op::Pow
+  double _aux;
   vector<ValuePtr> _children;
-  std::function<void()> _backward;
+  Op _op = Op::Leaf;
+  // false for constants and data, backward never descends into such nodes
+  bool _requires_grad = true;
+  // payload of tensor nodes, null for scalars
+  std::unique_ptr<Tensor> _tensor;
+};
+
+// Leaf grads of backward() calls collected on one thread instead of being
+// added to the leaves, see ShardedGradGuard. Merging the shards of several
+// threads one after the other, once they have finished, needs no atomics and
+// sums in a fixed order. The leaves must stay alive until merged.
+class GradShard {
+ public:
+  void add(Value& leaf, double grad) {
+    auto slot = _index.insert({&leaf, _grads.size()});
+    if (slot.second) {
+      _grads.emplace_back(&leaf, grad);
+    } else {
+      _grads[slot.first->second].second += grad;
+    }
+  }
+
+  // grad collected for `leaf` so far
+  double grad(const Value& leaf) const {
+    auto slot = _index.find(const_cast<Value*>(&leaf));
+    return slot == _index.end() ? 0.0 : _grads[slot->second].second;
+  }
+
+  // private grad array of tensor leaf `leaf`, zeroed when first requested
+  double* tensor_grad(Value& leaf) {
+    auto slot = _tensor_index.insert({&leaf, _tensor_grads.size()});
+    if (slot.second) {
+      _tensor_grads.emplace_back(&leaf,
+                                 vector<double>(leaf.tensor().size(), 0.0));
+    }
+    return _tensor_grads[slot.first->second].second.data();
+  }
+
+  size_t size() const { return _grads.size() + _tensor_grads.size(); }
+
+  // adds the collected grads to the leaves, in first-touched order, and
+  // empties the shard
+  void merge() {
+    for (auto& [leaf, grad] : _grads) {
+      leaf->_grad += grad;
+    }
+    for (auto& [leaf, grad] : _tensor_grads) {
+      auto dst = leaf->tensor().grad();
+      for (size_t i = 0; i < grad.size(); ++i) {
+        dst[i] += grad[i];
+      }
+    }
+    _grads.clear();
+    _index.clear();
+    _tensor_grads.clear();
+    _tensor_index.clear();
+  }
+
+ private:
+  vector<std::pair<Value*, double>> _grads;
+  std::unordered_map<Value*, size_t> _index;
+  vector<std::pair<Value*, vector<double>>> _tensor_grads;
+  std::unordered_map<Value*, size_t> _tensor_index;
+};
+
+// Sends the leaf grads of this thread's backward() calls to `shard` for its
+// scope.
+class ShardedGradGuard {
+ public:
+  explicit ShardedGradGuard(GradShard& shard)
+      : _prev{GradMode::accumulation()}, _prev_shard{current()} {
+    GradMode::set_accumulation(Accumulation::Sharded);
+    current() = &shard;
+  }
+  ~ShardedGradGuard() {
+    GradMode::set_accumulation(_prev);
+    current() = _prev_shard;
+  }
+  ShardedGradGuard(const ShardedGradGuard&) = delete;
+  ShardedGradGuard& operator=(const ShardedGradGuard&) = delete;
+
+  static GradShard& active() { return *current(); }
+
+ private:
+  static GradShard*& current() {
+    static thread_local GradShard* shard = nullptr;
+    return shard;
+  }
+
+  Accumulation _prev;
+  GradShard* _prev_shard;
 };
 
+inline double* Value::shard_grad(Value& leaf) {
+  return ShardedGradGuard::active().tensor_grad(leaf);
+}
+
+inline void Value::accumulate_shared(Value& node, double grad) {
+  switch (GradMode::accumulation()) {
+    case Accumulation::Plain:
+      node._grad += grad;
+      break;
+    case Accumulation::Atomic:
+      atomic_add(node._grad, grad);
+      break;
+    case Accumulation::Sharded:
+      ShardedGradGuard::active().add(node, grad);
+      break;
+  }
+}
+
+inline void Reclaimer::release(vector<ValuePtr> nodes) {
+  if (deferred()) {
+    worker().push(std::move(nodes));
+    return;
+  }
+  unlink(nodes);
+}
+
+inline void Reclaimer::unlink(vector<ValuePtr>& worklist) {
+  while (!worklist.empty()) {
+    auto node = std::move(worklist.back());
+    worklist.pop_back();
+    // a node shared with the rest of the program only loses this handle
+    if (node.use_count() == 1) {
+      auto& children = node->_children;
+      worklist.insert(worklist.end(), std::make_move_iterator(children.begin()),
+                      std::make_move_iterator(children.end()));
+      children.clear();
+    }
+  }
+}
+
+// Builds the result node of an op, or under NoGradGuard a pooled constant.
+template <typename... Children>
+ValuePtr make_op(double data, Op op, double aux, const Children&... children) {
+  if (!GradMode::is_enabled()) {
+    return make_pooled<Value>(data, false);
+  }
+  return make_value(data, vector<ValuePtr>{children...}, op, aux);
+}
+
+// Builds the tensor result of an op, or under NoGradGuard a tensor constant.
+template <typename... Children>
+ValuePtr make_tensor_op(std::unique_ptr<Tensor> out, Op op,
+                        const Children&... children) {
+  if (!GradMode::is_enabled()) {
+    return make_value(std::move(out), false);
+  }
+  return make_value(std::move(out), vector<ValuePtr>{children...}, op);
+}
+
 inline ValuePtr operator+(ValuePtr lhs, ValuePtr rhs) {
-  auto out =
-      make_shared<Value>(lhs->data() + rhs->data(), vector<ValuePtr>{lhs, rhs});
-  out->_backward = [out, lhs, rhs]() {
-    lhs->_grad += out->_grad;
-    rhs->_grad += out->_grad;
-  };
-  return out;
+  auto data = lhs->data() + rhs->data();
+  return make_op(data, Op::Add, 0.0, lhs, rhs);
 }
 
 inline ValuePtr operator+(ValuePtr lhs, double val) {
-  auto rhs = make_shared<Value>(val);
-  return lhs + rhs;
+  auto data = lhs->data() + val;
+  return make_op(data, Op::AddConst, val, lhs);
 }
 
+inline ValuePtr operator+(double val, ValuePtr rhs) { return rhs + val; }
+
 inline ValuePtr operator*(ValuePtr lhs, ValuePtr rhs) {
-  auto out =
-      make_shared<Value>(lhs->data() * rhs->data(), vector<ValuePtr>{lhs, rhs});
-  out->_backward = [out, lhs, rhs]() {
-    lhs->_grad += rhs->data() * out->_grad;
-    rhs->_grad += lhs->data() * out->_grad;
-  };
-  return out;
+  auto data = lhs->data() * rhs->data();
+  return make_op(data, Op::Mul, 0.0, lhs, rhs);
 }
 
 inline ValuePtr operator*(ValuePtr lhs, double val) {
-  auto rhs = make_shared<Value>(val);
-  return lhs * rhs;
+  auto data = lhs->data() * val;
+  return make_op(data, Op::MulConst, val, lhs);
 }
 
-inline ValuePtr operator*(double val, ValuePtr rhs) {
-  auto lhs = make_shared<Value>(val);
-  return lhs * rhs;
-}
+inline ValuePtr operator*(double val, ValuePtr rhs) { return rhs * val; }
 
 inline ValuePtr operator-(ValuePtr rhs) {
-  return rhs * make_shared<Value>(-1.0);
+  return make_op(-rhs->data(), Op::Neg, 0.0, rhs);
 }
 
-inline ValuePtr operator-(ValuePtr lhs, ValuePtr rhs) { return lhs + (-rhs); }
+inline ValuePtr operator-(ValuePtr lhs, ValuePtr rhs) {
+  auto data = lhs->data() - rhs->data();
+  return make_op(data, Op::Sub, 0.0, lhs, rhs);
+}
+
+inline ValuePtr operator-(ValuePtr lhs, double val) { return lhs + (-val); }
+
+inline ValuePtr operator-(double val, ValuePtr rhs) {
+  auto data = val - rhs->data();
+  return make_op(data, Op::RSubConst, val, rhs);
+}
 
 inline ValuePtr operator/(ValuePtr lhs, ValuePtr rhs) {
-  return lhs * rhs->pow(make_shared<Value>(-1));
+  auto data = lhs->data() / rhs->data();
+  return make_op(data, Op::Div, 0.0, lhs, rhs);
 }
 
 inline ValuePtr operator/(ValuePtr lhs, double val) {
-  auto rhs = make_shared<Value>(val);
-  return lhs / rhs;
+  auto data = lhs->data() / val;
+  return make_op(data, Op::DivConst, val, lhs);
 }
 
 inline ValuePtr operator/(double val, ValuePtr rhs) {
-  auto lhs = make_shared<Value>(val);
-  return lhs / rhs;
+  auto data = val / rhs->data();
+  return make_op(data, Op::RDivConst, val, rhs);
+}
+
+// One n-ary node instead of the left-deep chain std::accumulate would build.
+inline ValuePtr sum(const vector<ValuePtr>& vals) {
+  double data = 0.0;
+  for (auto& val : vals) {
+    data += val->data();
+  }
+  if (!GradMode::is_enabled()) {
+    return make_op(data, Op::Sum, 0.0);
+  }
+  return make_value(data, vals, Op::Sum);
+}
+
+// One node for sum(lhs[i] * rhs[i]) instead of n products and n - 1 sums.
+inline ValuePtr dot(const vector<ValuePtr>& lhs, const vector<ValuePtr>& rhs) {
+  assert(lhs.size() == rhs.size());
+  double data = 0.0;
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    data += lhs[i]->data() * rhs[i]->data();
+  }
+  if (!GradMode::is_enabled()) {
+    return make_op(data, Op::Dot, 0.0);
+  }
+  vector<ValuePtr> children;
+  children.reserve(lhs.size() * 2);
+  children.insert(children.end(), lhs.begin(), lhs.end());
+  children.insert(children.end(), rhs.begin(), rhs.end());
+  return make_value(data, std::move(children), Op::Dot);
+}
+
+// A [rows x cols] tensor leaf, zero-filled unless `data` is given.
+inline ValuePtr make_tensor(size_t rows, size_t cols, vector<double> data = {},
+                            bool requires_grad = true) {
+  auto tensor = data.empty() ? std::make_unique<Tensor>(rows, cols)
+                             : std::make_unique<Tensor>(rows, cols,
+                                                        std::move(data));
+  return make_value(std::move(tensor), requires_grad);
+}
+
+// [m x k] times [k x n] as one node
+inline ValuePtr matmul(const ValuePtr& lhs, const ValuePtr& rhs) {
+  auto& a = lhs->tensor();
+  auto& b = rhs->tensor();
+  assert(a.cols() == b.rows());
+  auto out = std::make_unique<Tensor>(a.rows(), b.cols());
+  gemm(false, false, a.rows(), b.cols(), a.cols(), a.data(), b.data(),
+       out->data());
+  return make_tensor_op(std::move(out), Op::MatMul, lhs, rhs);
+}
+
+// Affine map of a batch, x [batch x in] * w [in x out] + b [1 x out], as one
+// node whose backward is two matrix products and a column sum. With `relu`
+// the activation is fused in as well: the bias and the max run in the gemm
+// epilogue while each tile of the output is still in cache.
+inline ValuePtr linear(const ValuePtr& x, const ValuePtr& w, const ValuePtr& b,
+                       bool relu = false) {
+  auto& xt = x->tensor();
+  auto& wt = w->tensor();
+  auto& bt = b->tensor();
+  assert(xt.cols() == wt.rows() && bt.size() == wt.cols());
+  auto batch = xt.rows(), out_nr = wt.cols();
+  auto out = std::make_unique<Tensor>(batch, out_nr);
+  GemmEpilogue epilogue;
+  epilogue.bias = bt.data();
+  epilogue.relu = relu;
+  gemm(false, false, batch, out_nr, xt.cols(), xt.data(), wt.data(),
+       out->data(), false, epilogue);
+  return make_tensor_op(std::move(out), relu ? Op::LinearRelu : Op::Linear, x,
+                        w, b);
+}
+
+// One neuron over scalar inputs as one node: w is a [1 x (n + 1)] tensor of
+// n contiguous weights followed by the bias, the forward is a vectorized dot
+// of the weights with the gathered inputs and `relu` fuses the activation.
+// The backward adds grad * x to the weights in one axpy.
+inline ValuePtr neuron(const ValuePtr& w, const vector<ValuePtr>& x,
+                       bool relu = false) {
+  auto& wt = w->tensor();
+  auto n = x.size();
+  assert(wt.size() == n + 1);
+  auto data = vdot(n, wt.data(), Value::gather(x.data(), n)) + wt.data()[n];
+  if (relu) {
+    data = std::max(0.0, data);
+  }
+  auto aux = relu ? 1.0 : 0.0;
+  if (!GradMode::is_enabled()) {
+    return make_op(data, Op::Neuron, aux);
+  }
+  vector<ValuePtr> children;
+  children.reserve(n + 1);
+  children.push_back(w);
+  children.insert(children.end(), x.begin(), x.end());
+  return make_value(data, std::move(children), Op::Neuron, aux);
+}
+
+// A batch through a set of neurons as one node: x is [batch x in], every row
+// a [1 x (in + 1)] tensor of weights followed by the bias (see Neuron), and
+// output column j is x times row j plus its bias, relu'd with `relu`. The
+// rows are stacked into one matrix so forward and backward run on gemm.
+inline ValuePtr dense(const ValuePtr& x, const vector<ValuePtr>& rows,
+                      bool relu = false) {
+  auto& xt = x->tensor();
+  auto batch = xt.rows(), in = xt.cols(), out_nr = rows.size();
+  vector<double> w(out_nr * in), bias(out_nr);
+  assert(std::all_of(rows.begin(), rows.end(), [&](const ValuePtr& row) {
+    return row->tensor().size() == in + 1;
+  }));
+  Value::stack_rows(rows.data(), out_nr, in, w.data(), bias.data());
+  auto out = std::make_unique<Tensor>(batch, out_nr);
+  GemmEpilogue epilogue;
+  epilogue.bias = bias.data();
+  epilogue.relu = relu;
+  gemm(false, true, batch, out_nr, in, xt.data(), w.data(), out->data(), false,
+       epilogue);
+  if (!GradMode::is_enabled()) {
+    return make_value(std::move(out), false);
+  }
+  vector<ValuePtr> children;
+  children.reserve(out_nr + 1);
+  children.push_back(x);
+  children.insert(children.end(), rows.begin(), rows.end());
+  return make_value(std::move(out), std::move(children), Op::Dense,
+                    relu ? 1.0 : 0.0);
+}
+
+// Sum of all entries of a tensor, a scalar node.
+inline ValuePtr sum(const ValuePtr& tensor) {
+  auto& t = tensor->tensor();
+  double data = 0.0;
+  for (size_t i = 0; i < t.size(); ++i) {
+    data += t.data()[i];
+  }
+  return make_op(data, Op::TensorSum, 0.0, tensor);
+}
+
+// Gathers scalar nodes into a [rows x cols] tensor node, row-major; by
+// default one row.
+inline ValuePtr stack(const vector<ValuePtr>& vals, size_t rows = 1,
+                      size_t cols = 0) {
+  cols = cols ? cols : vals.size() / std::max<size_t>(rows, 1);
+  assert(rows * cols == vals.size());
+  auto out = std::make_unique<Tensor>(rows, cols);
+  for (size_t i = 0; i < vals.size(); ++i) {
+    out->data()[i] = vals[i]->data();
+  }
+  if (!GradMode::is_enabled()) {
+    return make_value(std::move(out), false);
+  }
+  return make_value(std::move(out), vals, Op::Stack);
+}
+
+// L2 regularizer: coefficient * the sum of squares of the tensors, one node
+inline ValuePtr l2_penalty(const vector<ValuePtr>& tensors,
+                           double coefficient = 1.0) {
+  double data = 0.0;
+  for (auto& node : tensors) {
+    auto& t = node->tensor();
+    data += vdot(t.size(), t.data(), t.data());
+  }
+  data *= coefficient;
+  if (!GradMode::is_enabled()) {
+    return make_op(data, Op::L2Penalty, coefficient);
+  }
+  return make_value(data, tensors, Op::L2Penalty, coefficient);
+}
+
+// Entry (row, col) of a tensor node as a scalar node.
+inline ValuePtr element(const ValuePtr& tensor, size_t row, size_t col) {
+  auto& t = tensor->tensor();
+  auto idx = row * t.cols() + col;
+  return make_op(t.data()[idx], Op::Element, static_cast<double>(idx), tensor);
 }
 
 }  // namespace ugrad
@@ -0,0 +1,418 @@
+#ifndef __UGRAD_GEMM_HPP__
+#define __UGRAD_GEMM_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include <ugrad/simd.hpp>
+#include <ugrad/thread_pool.hpp>
+
+namespace ugrad {
+
+// Double-precision matrix multiply in the Goto/BLIS scheme. C is walked in
+// NC-wide column panels and the shared dimension in KC-deep slices; the
+// [KC x NC] slice of B is packed once into NR-wide slivers sized for L3, and
+// every MC-tall block of A into MR-tall slivers sized for L2. A register-tiled
+// micro-kernel then multiplies one A sliver by one B sliver, streaming the
+// KC x NR sliver of B out of L1. Packing absorbs the transposes, so all four
+// op(A) * op(B) variants run the same kernels.
+
+// Instruction set of the micro-kernel, the best one the CPU supports is
+// picked at runtime.
+using GemmIsa = SimdIsa;
+
+// Applied to each tile of C once its last KC slice is in: C += bias (one
+// value per column), then C = max(C, 0) with `relu`.
+struct GemmEpilogue {
+  const double* bias = nullptr;
+  bool relu = false;
+};
+
+// c[MR x NR] (+)= a-sliver * b-sliver over kc steps, ldc is C's row stride
+using GemmMicroKernel = void (*)(size_t kc, const double* a, const double* b,
+                                 double* c, size_t ldc, bool overwrite);
+
+struct GemmKernel {
+  GemmIsa isa;
+  const char* name;
+  size_t mr, nr;
+  size_t mc, kc, nc;
+  GemmMicroKernel run;
+};
+
+template <size_t MR, size_t NR>
+void gemm_kernel_scalar(size_t kc, const double* a, const double* b, double* c,
+                        size_t ldc, bool overwrite) {
+  double acc[MR][NR] = {};
+  for (size_t p = 0; p < kc; ++p, a += MR, b += NR) {
+    for (size_t r = 0; r < MR; ++r) {
+      for (size_t j = 0; j < NR; ++j) {
+        acc[r][j] += a[r] * b[j];
+      }
+    }
+  }
+  for (size_t r = 0; r < MR; ++r) {
+    for (size_t j = 0; j < NR; ++j) {
+      c[r * ldc + j] = overwrite ? acc[r][j] : c[r * ldc + j] + acc[r][j];
+    }
+  }
+}
+
+#ifdef UGRAD_SIMD_X86
+// 4 x 4 tile in eight 2-wide registers, baseline x86-64
+inline void gemm_kernel_sse2(size_t kc, const double* a, const double* b,
+                             double* c, size_t ldc, bool overwrite) {
+  __m128d acc[4][2];
+  for (auto& row : acc) {
+    row[0] = row[1] = _mm_setzero_pd();
+  }
+  for (size_t p = 0; p < kc; ++p, a += 4, b += 4) {
+    auto b0 = _mm_loadu_pd(b);
+    auto b1 = _mm_loadu_pd(b + 2);
+    for (size_t r = 0; r < 4; ++r) {
+      auto ar = _mm_set1_pd(a[r]);
+      acc[r][0] = _mm_add_pd(acc[r][0], _mm_mul_pd(ar, b0));
+      acc[r][1] = _mm_add_pd(acc[r][1], _mm_mul_pd(ar, b1));
+    }
+  }
+  for (size_t r = 0; r < 4; ++r) {
+    auto row = c + r * ldc;
+    for (size_t v = 0; v < 2; ++v) {
+      auto out = overwrite ? acc[r][v]
+                           : _mm_add_pd(_mm_loadu_pd(row + 2 * v), acc[r][v]);
+      _mm_storeu_pd(row + 2 * v, out);
+    }
+  }
+}
+
+// 6 x 8 tile: twelve accumulators, two B vectors and a broadcast fill the
+// sixteen ymm registers
+__attribute__((target("avx2,fma"))) inline void gemm_kernel_avx2(
+    size_t kc, const double* a, const double* b, double* c, size_t ldc,
+    bool overwrite) {
+  __m256d acc[6][2];
+  for (auto& row : acc) {
+    row[0] = row[1] = _mm256_setzero_pd();
+  }
+  for (size_t p = 0; p < kc; ++p, a += 6, b += 8) {
+    auto b0 = _mm256_loadu_pd(b);
+    auto b1 = _mm256_loadu_pd(b + 4);
+    for (size_t r = 0; r < 6; ++r) {
+      auto ar = _mm256_broadcast_sd(a + r);
+      acc[r][0] = _mm256_fmadd_pd(ar, b0, acc[r][0]);
+      acc[r][1] = _mm256_fmadd_pd(ar, b1, acc[r][1]);
+    }
+  }
+  for (size_t r = 0; r < 6; ++r) {
+    auto row = c + r * ldc;
+    for (size_t v = 0; v < 2; ++v) {
+      auto out = overwrite ? acc[r][v]
+                           : _mm256_add_pd(_mm256_loadu_pd(row + 4 * v),
+                                           acc[r][v]);
+      _mm256_storeu_pd(row + 4 * v, out);
+    }
+  }
+}
+
+// 8 x 24 tile: twenty-four zmm accumulators, three B vectors and a broadcast
+__attribute__((target("avx512f"))) inline void gemm_kernel_avx512(
+    size_t kc, const double* a, const double* b, double* c, size_t ldc,
+    bool overwrite) {
+  __m512d acc[8][3];
+  for (auto& row : acc) {
+    row[0] = row[1] = row[2] = _mm512_setzero_pd();
+  }
+  for (size_t p = 0; p < kc; ++p, a += 8, b += 24) {
+    auto b0 = _mm512_loadu_pd(b);
+    auto b1 = _mm512_loadu_pd(b + 8);
+    auto b2 = _mm512_loadu_pd(b + 16);
+    for (size_t r = 0; r < 8; ++r) {
+      auto ar = _mm512_set1_pd(a[r]);
+      acc[r][0] = _mm512_fmadd_pd(ar, b0, acc[r][0]);
+      acc[r][1] = _mm512_fmadd_pd(ar, b1, acc[r][1]);
+      acc[r][2] = _mm512_fmadd_pd(ar, b2, acc[r][2]);
+    }
+  }
+  for (size_t r = 0; r < 8; ++r) {
+    auto row = c + r * ldc;
+    for (size_t v = 0; v < 3; ++v) {
+      auto out = overwrite ? acc[r][v]
+                           : _mm512_add_pd(_mm512_loadu_pd(row + 8 * v),
+                                           acc[r][v]);
+      _mm512_storeu_pd(row + 8 * v, out);
+    }
+  }
+}
+#endif
+
+inline bool gemm_supports(GemmIsa isa) { return simd_supports(isa); }
+
+// Block sizes keep MC and NC multiples of the tile; KC x NR doubles of B stay
+// in L1, MC x KC of A in L2 and KC x NC of B in L3.
+inline const GemmKernel& gemm_kernel(GemmIsa isa) {
+  static const GemmKernel kernels[] = {
+      {GemmIsa::Scalar, "scalar", 4, 4, 128, 256, 4096,
+       gemm_kernel_scalar<4, 4>},
+#ifdef UGRAD_SIMD_X86
+      {GemmIsa::SSE2, "sse2", 4, 4, 128, 256, 4096, gemm_kernel_sse2},
+      {GemmIsa::AVX2, "avx2", 6, 8, 120, 256, 4096, gemm_kernel_avx2},
+      {GemmIsa::AVX512, "avx512", 8, 24, 128, 192, 3072, gemm_kernel_avx512},
+#endif
+  };
+  for (auto& kernel : kernels) {
+    if (kernel.isa == isa) {
+      return kernel;
+    }
+  }
+  return kernels[0];
+}
+
+inline std::atomic<GemmIsa>& gemm_isa_slot() {
+  static std::atomic<GemmIsa> isa{best_simd_isa()};
+  return isa;
+}
+
+inline GemmIsa gemm_isa() { return gemm_isa_slot().load(); }
+
+// forces a micro-kernel, e.g. to compare them; the CPU must support it
+inline void set_gemm_isa(GemmIsa isa) {
+  assert(gemm_supports(isa));
+  gemm_isa_slot() = isa;
+}
+
+// 64-byte aligned scratch that only ever grows
+class GemmBuffer {
+ public:
+  GemmBuffer() = default;
+  GemmBuffer(const GemmBuffer&) = delete;
+  GemmBuffer& operator=(const GemmBuffer&) = delete;
+
+  double* reserve(size_t size) {
+    if (size > _size) {
+      auto bytes = (size * sizeof(double) + 63) / 64 * 64;
+      auto ptr = static_cast<double*>(std::aligned_alloc(64, bytes));
+      if (!ptr) {
+        throw std::bad_alloc();
+      }
+      _data.reset(ptr);
+      _size = size;
+    }
+    return _data.get();
+  }
+
+ private:
+  struct Free {
+    void operator()(double* ptr) const { std::free(ptr); }
+  };
+  std::unique_ptr<double, Free> _data;
+  size_t _size = 0;
+};
+
+// C = op(A) op(B) with the textbook triple loop, the baseline the blocked
+// kernel is tested and benchmarked against
+inline void gemm_reference(bool trans_a, bool trans_b, size_t m, size_t n,
+                           size_t k, const double* a, const double* b,
+                           double* c) {
+  for (size_t i = 0; i < m; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      double sum = 0.0;
+      for (size_t p = 0; p < k; ++p) {
+        sum += (trans_a ? a[p * m + i] : a[i * k + p]) *
+               (trans_b ? b[j * k + p] : b[p * n + j]);
+      }
+      c[i * n + j] = sum;
+    }
+  }
+}
+
+// mc rows of op(A) from row `row`, depth slice [depth, depth + kc), as
+// MR-tall slivers: each holds kc columns of MR values, zero-padded
+inline void gemm_pack_a(const GemmKernel& kernel, bool trans_a, size_t m,
+                        size_t k, const double* a, size_t row, size_t mc,
+                        size_t depth, size_t kc, double* out) {
+  auto mr = kernel.mr;
+  for (size_t ir = 0; ir < mc; ir += mr) {
+    auto rows = std::min(mr, mc - ir);
+    for (size_t p = 0; p < kc; ++p) {
+      for (size_t r = 0; r < mr; ++r) {
+        auto i = row + ir + r;
+        auto pp = depth + p;
+        *out++ = r < rows ? (trans_a ? a[pp * m + i] : a[i * k + pp]) : 0.0;
+      }
+    }
+  }
+}
+
+// kc rows of op(B) from `depth`, columns [col, col + nc), as NR-wide slivers:
+// each holds kc rows of NR values, zero-padded
+inline void gemm_pack_b(const GemmKernel& kernel, bool trans_b, size_t n,
+                        size_t k, const double* b, size_t depth, size_t kc,
+                        size_t col, size_t nc, double* out) {
+  auto nr = kernel.nr;
+  for (size_t jr = 0; jr < nc; jr += nr) {
+    auto cols = std::min(nr, nc - jr);
+    for (size_t p = 0; p < kc; ++p) {
+      auto pp = depth + p;
+      for (size_t j = 0; j < nr; ++j) {
+        auto jj = col + jr + j;
+        *out++ = j < cols ? (trans_b ? b[jj * k + pp] : b[pp * n + jj]) : 0.0;
+      }
+    }
+  }
+}
+
+// C += op(A) op(B) when C is a single row or column. The vector operand is
+// contiguous in either layout: a row of A for m == 1, a column of B for
+// n == 1.
+inline void gemv(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+                 const double* a, const double* b, double* c) {
+  if (n == 1) {
+    if (trans_a) {
+      // c += sum over p of b[p] * A^T row p
+      for (size_t p = 0; p < k; ++p) {
+        axpy(m, b[p], a + p * m, c);
+      }
+    } else {
+      for (size_t i = 0; i < m; ++i) {
+        c[i] += vdot(k, a + i * k, b);
+      }
+    }
+    return;
+  }
+  if (trans_b) {
+    for (size_t j = 0; j < n; ++j) {
+      c[j] += vdot(k, a, b + j * k);
+    }
+  } else {
+    for (size_t p = 0; p < k; ++p) {
+      axpy(n, a[p], b + p * n, c);
+    }
+  }
+}
+
+// below this many multiply-adds the blocked kernel runs on the calling thread
+constexpr size_t kGemmMinParallelWork = size_t{1} << 18;
+
+// C[m x n] (+)= op(A) op(B), all row-major, op(X) being X or its transpose:
+// A is [m x k] or, with trans_a, [k x m]; B is [k x n] or, with trans_b,
+// [n x k]. Without `accumulate` C is overwritten. The epilogue is applied to
+// the finished C. Large products are split over the default pool by blocks
+// of rows and column slivers of C, each written by one task.
+inline void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+                 const double* a, const double* b, double* c,
+                 bool accumulate = false, const GemmEpilogue& epilogue = {}) {
+  auto apply_epilogue = [&](size_t row, size_t rows, size_t col, size_t cols) {
+    if (!epilogue.bias && !epilogue.relu) {
+      return;
+    }
+    for (size_t i = row; i < row + rows; ++i) {
+      auto c_row = c + i * n;
+      for (size_t j = col; j < col + cols; ++j) {
+        auto v = c_row[j] + (epilogue.bias ? epilogue.bias[j] : 0.0);
+        c_row[j] = epilogue.relu ? std::max(v, 0.0) : v;
+      }
+    }
+  };
+  if (m == 0 || n == 0) {
+    return;
+  }
+  if (k == 0) {
+    if (!accumulate) {
+      std::fill(c, c + m * n, 0.0);
+    }
+    apply_epilogue(0, m, 0, n);
+    return;
+  }
+  if (m == 1 || n == 1) {
+    // matrix-vector products: a tile would be mostly padding, the vector
+    // kernels run them on dots or axpys over contiguous rows instead
+    if (!accumulate) {
+      std::fill(c, c + m * n, 0.0);
+    }
+    gemv(trans_a, trans_b, m, n, k, a, b, c);
+    apply_epilogue(0, m, 0, n);
+    return;
+  }
+
+  auto& kernel = gemm_kernel(gemm_isa());
+  auto mr = kernel.mr, nr = kernel.nr;
+  auto parallel = m * n * k >= kGemmMinParallelWork;
+  auto shared_pool = default_pool();
+  auto& pool = *shared_pool;
+  // a thread waiting on the parallel loop may run another gemm meanwhile, so
+  // only serial calls can keep the packed B in the per-thread buffer
+  static thread_local GemmBuffer b_local;
+  GemmBuffer b_owned;
+  auto& b_buffer = parallel ? b_owned : b_local;
+  auto b_pack = b_buffer.reserve(kernel.kc * (kernel.nc + nr));
+
+  for (size_t jc = 0; jc < n; jc += kernel.nc) {
+    auto nc = std::min(kernel.nc, n - jc);
+    auto slivers = (nc + nr - 1) / nr;
+    for (size_t pc = 0; pc < k; pc += kernel.kc) {
+      auto kc = std::min(kernel.kc, k - pc);
+      auto overwrite = pc == 0 && !accumulate;
+      auto last = pc + kc == k;
+      gemm_pack_b(kernel, trans_b, n, k, b, pc, kc, jc, nc, b_pack);
+
+      // tasks are (row block, column chunk) pairs, enough chunks to give
+      // every thread work even when m spans a single block
+      auto row_blocks = (m + kernel.mc - 1) / kernel.mc;
+      auto chunks = parallel ? std::min(slivers, std::max<size_t>(
+                                   1, 2 * pool.size() / row_blocks))
+                             : 1;
+      auto task = [&](size_t t) {
+        static thread_local GemmBuffer a_buffer;
+        auto ic = (t / chunks) * kernel.mc;
+        auto mc = std::min(kernel.mc, m - ic);
+        auto chunk = t % chunks;
+        auto first = slivers * chunk / chunks;
+        auto end = slivers * (chunk + 1) / chunks;
+        auto a_pack = a_buffer.reserve(kernel.kc * (kernel.mc + mr));
+        gemm_pack_a(kernel, trans_a, m, k, a, ic, mc, pc, kc, a_pack);
+        alignas(64) double tile[8 * 24];
+        for (auto s = first; s < end; ++s) {
+          auto jr = s * nr;
+          auto cols = std::min(nr, nc - jr);
+          auto b_sliver = b_pack + s * kc * nr;
+          for (size_t ir = 0; ir < mc; ir += mr) {
+            auto rows = std::min(mr, mc - ir);
+            auto c_tile = c + (ic + ir) * n + jc + jr;
+            auto a_sliver = a_pack + ir * kc;
+            if (rows == mr && cols == nr) {
+              kernel.run(kc, a_sliver, b_sliver, c_tile, n, overwrite);
+            } else {
+              // edge tile: full tile into scratch, valid part into C
+              kernel.run(kc, a_sliver, b_sliver, tile, nr, true);
+              for (size_t r = 0; r < rows; ++r) {
+                for (size_t j = 0; j < cols; ++j) {
+                  auto& out = c_tile[r * n + j];
+                  out = overwrite ? tile[r * nr + j] : out + tile[r * nr + j];
+                }
+              }
+            }
+            if (last) {
+              apply_epilogue(ic + ir, rows, jc + jr, cols);
+            }
+          }
+        }
+      };
+      auto tasks = row_blocks * chunks;
+      if (parallel) {
+        parallel_for(pool, 0, tasks, task);
+      } else {
+        for (size_t t = 0; t < tasks; ++t) {
+          task(t);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace ugrad
+#endif  // __UGRAD_GEMM_HPP__
@@ -0,0 +1,163 @@
+#ifndef __UGRAD_HANDLE_HPP__
+#define __UGRAD_HANDLE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace ugrad {
+
+// Size-class slab allocator: blocks of up to kMaxBytes are carved out of
+// 64 KiB slabs and recycled through one intrusive free list per 16-byte size
+// class, so node churn never reaches malloc. State is per thread and nothing
+// is locked, blocks must be released on the thread that allocated them.
+class SlabAllocator {
+ public:
+  static void* allocate(size_t bytes) {
+    if (bytes > kMaxBytes) {
+      return ::operator new(bytes);
+    }
+    auto& arena = local();
+    auto& head = arena._free[size_class(bytes)];
+    ++arena._live;
+    if (head) {
+      auto block = head;
+      head = *static_cast<void**>(block);
+      return block;
+    }
+    auto size = (size_class(bytes) + 1) * kGranularity;
+    if (arena._cursor + size > arena._end) {
+      auto slab = static_cast<char*>(::operator new(kSlabBytes));
+      arena._slabs.push_back(slab);
+      arena._cursor = slab;
+      arena._end = slab + kSlabBytes;
+    }
+    auto block = arena._cursor;
+    arena._cursor += size;
+    return block;
+  }
+
+  static void deallocate(void* ptr, size_t bytes) {
+    if (bytes > kMaxBytes) {
+      ::operator delete(ptr);
+      return;
+    }
+    auto& arena = local();
+    auto& head = arena._free[size_class(bytes)];
+    *static_cast<void**>(ptr) = head;
+    head = ptr;
+    --arena._live;
+  }
+
+  // blocks handed out and not yet returned on this thread
+  static size_t live() { return local()._live; }
+
+ private:
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxBytes = 256;
+  static constexpr size_t kSlabBytes = 64 << 10;
+
+  static size_t size_class(size_t bytes) {
+    return bytes == 0 ? 0 : (bytes - 1) / kGranularity;
+  }
+
+  struct Arena {
+    ~Arena() {
+      // with blocks still alive (e.g. held by statics destroyed later) the
+      // slabs are left to the process teardown rather than freed under them
+      if (_live == 0) {
+        for (auto slab : _slabs) {
+          ::operator delete(slab);
+        }
+      }
+    }
+    void* _free[kMaxBytes / kGranularity] = {};
+    std::vector<char*> _slabs;
+    char* _cursor = nullptr;
+    char* _end = nullptr;
+    size_t _live = 0;
+  };
+
+  static Arena& local() {
+    static thread_local Arena arena;
+    return arena;
+  }
+};
+
+template <typename T>
+class Ref;
+
+// Base of objects managed by Ref: carries the non-atomic reference count.
+template <typename T>
+struct RefCounted {
+  // only valid for objects created by make_ref
+  Ref<T> shared_from_this() { return Ref<T>(static_cast<T*>(this)); }
+
+  uint32_t _refs = 0;
+};
+
+// Intrusive handle with a plain, non-atomic reference count, a drop-in for
+// shared_ptr in graphs built and released by a single thread: copies cost an
+// increment, there is no control block and no weak count.
+template <typename T>
+class Ref {
+ public:
+  Ref() = default;
+  Ref(std::nullptr_t) {}
+  explicit Ref(T* ptr) : _ptr{ptr} { retain(); }
+  Ref(const Ref& other) : _ptr{other._ptr} { retain(); }
+  Ref(Ref&& other) noexcept : _ptr{other._ptr} { other._ptr = nullptr; }
+  ~Ref() { release(); }
+
+  Ref& operator=(const Ref& other) {
+    Ref(other).swap(*this);
+    return *this;
+  }
+  Ref& operator=(Ref&& other) noexcept {
+    Ref(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  T* get() const { return _ptr; }
+  T& operator*() const { return *_ptr; }
+  T* operator->() const { return _ptr; }
+  explicit operator bool() const { return _ptr != nullptr; }
+  long use_count() const { return _ptr ? _ptr->_refs : 0; }
+  void reset() { Ref().swap(*this); }
+  void swap(Ref& other) noexcept { std::swap(_ptr, other._ptr); }
+
+  friend bool operator==(const Ref& lhs, const Ref& rhs) {
+    return lhs._ptr == rhs._ptr;
+  }
+  friend bool operator!=(const Ref& lhs, const Ref& rhs) {
+    return lhs._ptr != rhs._ptr;
+  }
+
+ private:
+  void retain() {
+    if (_ptr) {
+      ++_ptr->_refs;
+    }
+  }
+
+  void release() {
+    if (_ptr && --_ptr->_refs == 0) {
+      _ptr->~T();
+      SlabAllocator::deallocate(_ptr, sizeof(T));
+    }
+    _ptr = nullptr;
+  }
+
+  T* _ptr = nullptr;
+};
+
+template <typename T, typename... Args>
+Ref<T> make_ref(Args&&... args) {
+  auto mem = SlabAllocator::allocate(sizeof(T));
+  return Ref<T>(new (mem) T(std::forward<Args>(args)...));
+}
+
+}  // namespace ugrad
+#endif  // __UGRAD_HANDLE_HPP__
@@ -0,0 +1,122 @@
+#ifndef __UGRAD_LOSS_HPP__
+#define __UGRAD_LOSS_HPP__
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
+#include <ugrad/engine.hpp>
+
+namespace ugrad {
+namespace loss {
+
+// Batched losses of a [batch x k] tensor of scores against a tensor of
+// targets. Each one is the mean over the batch as a single scalar node with
+// its own Op code, whose backward writes the closed-form grad of the scores
+// in one pass; the accuracy of the scores is counted in the same pass as the
+// forward.
+struct Result {
+  ValuePtr loss;
+  double accuracy;
+};
+
+// the loss node, children are the scores and the targets
+inline Result make_loss(Op op, double data, double accuracy,
+                        const ValuePtr& scores, const ValuePtr& targets) {
+  if (!GradMode::is_enabled()) {
+    return {make_op(data, op, 0.0), accuracy};
+  }
+  return {make_value(data, vector<ValuePtr>{scores, targets}, op), accuracy};
+}
+
+inline size_t argmax(const double* row, size_t n) {
+  return static_cast<size_t>(std::max_element(row, row + n) - row);
+}
+
+// log(1 + exp(z)) without overflow
+inline double softplus(double z) {
+  return std::max(z, 0.0) + std::log1p(std::exp(-std::abs(z)));
+}
+
+// Mean SVM max-margin loss over every score, accuracy the share of scores
+// with the sign of their target.
+inline Result hinge(const ValuePtr& scores, const ValuePtr& targets) {
+  auto& s = scores->tensor();
+  auto y = targets->tensor().data();
+  assert(targets->tensor().size() == s.size());
+  double total = 0.0;
+  size_t correct = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    total += std::max(0.0, 1.0 - y[i] * s.data()[i]);
+    correct += (s.data()[i] > 0.0) == (y[i] > 0.0);
+  }
+  auto n = static_cast<double>(s.size());
+  return make_loss(Op::Hinge, total / n, correct / n, scores, targets);
+}
+
+// Mean squared error over every entry. Accuracy treats the outputs as class
+// scores: rows whose argmax is the target's, or whose sign is the target's
+// with a single column.
+inline Result mse(const ValuePtr& scores, const ValuePtr& targets) {
+  auto& s = scores->tensor();
+  auto& t = targets->tensor();
+  assert(t.rows() == s.rows() && t.cols() == s.cols());
+  double total = 0.0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    auto d = s.data()[i] - t.data()[i];
+    total += d * d;
+  }
+  size_t correct = 0;
+  for (size_t r = 0; r < s.rows(); ++r) {
+    auto row = s.data() + r * s.cols();
+    auto target = t.data() + r * s.cols();
+    auto k = s.cols();
+    correct += k == 1 ? (row[0] > 0.0) == (target[0] > 0.0)
+                      : argmax(row, k) == argmax(target, k);
+  }
+  return make_loss(Op::Mse, total / static_cast<double>(s.size()),
+                   static_cast<double>(correct) / s.rows(), scores, targets);
+}
+
+// Mean logistic loss, binary cross-entropy on logits, over every score;
+// accuracy as for hinge().
+inline Result logistic(const ValuePtr& scores, const ValuePtr& targets) {
+  auto& s = scores->tensor();
+  auto y = targets->tensor().data();
+  assert(targets->tensor().size() == s.size());
+  double total = 0.0;
+  size_t correct = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    total += softplus(-y[i] * s.data()[i]);
+    correct += (s.data()[i] > 0.0) == (y[i] > 0.0);
+  }
+  auto n = static_cast<double>(s.size());
+  return make_loss(Op::Logistic, total / n, correct / n, scores, targets);
+}
+
+// Mean cross-entropy of the softmax of [batch x classes] logits against a
+// [batch x 1] tensor of class indices, accuracy the share of rows whose
+// argmax is the label.
+inline Result softmax_cross_entropy(const ValuePtr& logits,
+                                    const ValuePtr& labels) {
+  auto& s = logits->tensor();
+  auto l = labels->tensor().data();
+  assert(labels->tensor().size() == s.rows() && s.cols() > 0);
+  double total = 0.0;
+  size_t correct = 0;
+  for (size_t r = 0; r < s.rows(); ++r) {
+    auto row = s.data() + r * s.cols();
+    auto label = static_cast<size_t>(l[r]);
+    assert(label < s.cols());
+    total += log_sum_exp(row, s.cols()) - row[label];
+    correct += argmax(row, s.cols()) == label;
+  }
+  auto n = static_cast<double>(s.rows());
+  return make_loss(Op::SoftmaxCrossEntropy, total / n, correct / n, logits,
+                   labels);
+}
+
+}  // namespace loss
+}  // namespace ugrad
+#endif  // __UGRAD_LOSS_HPP__
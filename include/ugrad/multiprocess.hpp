@@ -0,0 +1,307 @@
+#ifndef __UGRAD_MULTIPROCESS_HPP__
+#define __UGRAD_MULTIPROCESS_HPP__
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ugrad/data_parallel.hpp>
+
+namespace ugrad {
+
+// Data parallelism over processes instead of threads: each process has its
+// own heap, so the graphs of the ranks do not contend on one allocator. The
+// processes are forked on one machine and talk through a POSIX shared memory
+// segment only.
+
+// Shared memory created with shm_open under a unique name, mapped and
+// unlinked right away: only this process and the children it forks reach
+// it, and it goes away with the last of them. Empty if any call failed.
+class SharedSegment {
+ public:
+  explicit SharedSegment(size_t bytes) : _size{bytes} {
+    static std::atomic<unsigned> counter{0};
+    auto name = "/ugrad-" + std::to_string(getpid()) + "-" +
+                std::to_string(counter++);
+    auto fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      std::perror("shm_open");
+      return;
+    }
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+      auto ptr =
+          mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (ptr != MAP_FAILED) {
+        _data = ptr;
+      } else {
+        std::perror("mmap");
+      }
+    } else {
+      std::perror("ftruncate");
+    }
+    close(fd);
+    shm_unlink(name.c_str());
+  }
+
+  ~SharedSegment() {
+    if (_data) {
+      munmap(_data, _size);
+    }
+  }
+
+  SharedSegment(const SharedSegment&) = delete;
+  SharedSegment& operator=(const SharedSegment&) = delete;
+
+  explicit operator bool() const { return _data != nullptr; }
+  void* data() const { return _data; }
+  size_t size() const { return _size; }
+
+ private:
+  size_t _size;
+  void* _data = nullptr;
+};
+
+// One rank's view of the segment of a ProcessGroup: a sequence counter per
+// rank, each on its own cache line, then a slot of slot_size doubles per
+// rank. The counters are lock-free atomics, which work across processes.
+class ShmCommunicator {
+ public:
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> value{0};
+  };
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "sequence counters must be lock-free to be shared");
+
+  // doubles from one slot to the next, keeping slots 64-byte aligned
+  static size_t slot_stride(size_t slot_size) {
+    return (slot_size + 7) / 8 * 8;
+  }
+  static size_t segment_size(size_t ranks, size_t slot_size) {
+    return ranks * sizeof(Counter) +
+           ranks * slot_stride(slot_size) * sizeof(double);
+  }
+
+  ShmCommunicator(void* segment, size_t rank, size_t ranks, size_t slot_size)
+      : _counters{static_cast<Counter*>(segment)},
+        _rank{rank},
+        _ranks{ranks},
+        _slot_size{slot_size} {
+    assert(rank < ranks);
+    auto slots = reinterpret_cast<double*>(_counters + ranks);
+    for (size_t r = 0; r < ranks; ++r) {
+      _slots.push_back(slots + r * slot_stride(slot_size));
+    }
+  }
+
+  size_t rank() const { return _rank; }
+  size_t ranks() const { return _ranks; }
+  size_t slot_size() const { return _slot_size; }
+  double* slot(size_t rank) const { return _slots[rank]; }
+  double* slot() const { return _slots[_rank]; }
+
+  // Publishes this rank's next sequence number and waits until every rank
+  // has published it. A rank is at most one round ahead of the others, so
+  // the counters never need resetting within a run.
+  void arrive_and_wait() {
+    auto target = ++_sequence;
+    _counters[_rank].value.store(target, std::memory_order_release);
+    for (size_t r = 0; r < _ranks; ++r) {
+      while (_counters[r].value.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Replaces the first n entries of every slot by their sum over the ranks,
+  // with a ring reduce-scatter and all-gather. Every rank fills its slot()
+  // before the call and reads it after.
+  void all_reduce(size_t n, size_t bucket = kAllReduceBucket) {
+    assert(n <= _slot_size);
+    arrive_and_wait();
+    ring_all_reduce(_slots.data(), n, _rank, _ranks, *this, bucket);
+  }
+
+ private:
+  Counter* _counters;
+  size_t _rank;
+  size_t _ranks;
+  size_t _slot_size;
+  uint64_t _sequence = 0;
+  vector<double*> _slots;
+};
+
+// Forks `ranks` processes sharing one segment. The calling process only
+// supervises: run() waits for the children and, as soon as one of them
+// fails, kills the others, which could otherwise wait on a barrier forever.
+class ProcessGroup {
+ public:
+  ProcessGroup(size_t ranks, size_t slot_size)
+      : _ranks{ranks},
+        _slot_size{slot_size},
+        _segment{ShmCommunicator::segment_size(ranks, slot_size)} {
+    assert(ranks > 0);
+  }
+
+  explicit operator bool() const { return static_cast<bool>(_segment); }
+  size_t ranks() const { return _ranks; }
+
+  // the view of `rank`; the parent can read the slots after run()
+  ShmCommunicator communicator(size_t rank) const {
+    return {_segment.data(), rank, _ranks, _slot_size};
+  }
+
+  // Runs body(communicator) in every rank's process, which exits with what
+  // body returns, or 1 if it throws. The kernels of a rank run inline on its
+  // single thread and its graphs are freed in place. True when all ranks
+  // exited with 0.
+  bool run(const std::function<int(ShmCommunicator&)>& body) {
+    assert(_segment);
+    auto counters = static_cast<ShmCommunicator::Counter*>(_segment.data());
+    for (size_t r = 0; r < _ranks; ++r) {
+      new (counters + r) ShmCommunicator::Counter{};
+    }
+    std::fflush(nullptr);
+    vector<pid_t> pids;
+    for (size_t r = 0; r < _ranks; ++r) {
+      auto pid = fork();
+      if (pid == 0) {
+        // every way out of a rank goes through _exit, so a failing body
+        // never unwinds into the caller's code
+        int code = 1;
+        try {
+          // the reclaimer's worker thread does not survive fork()
+          Reclaimer::set_deferred(false);
+          auto comm = communicator(r);
+          ThreadPool serial{1};
+          PoolScope scope{serial};
+          code = body(comm);
+        } catch (...) {
+          code = 1;
+        }
+        std::fflush(nullptr);
+        _exit(code);
+      }
+      if (pid < 0) {
+        std::perror("fork");
+        break;
+      }
+      pids.push_back(pid);
+    }
+    auto ok = pids.size() == _ranks;
+    if (!ok) {
+      kill_all(pids);
+    }
+    auto running = pids.size();
+    while (running > 0) {
+      for (auto& pid : pids) {
+        int status = 0;
+        if (pid <= 0 || waitpid(pid, &status, WNOHANG) != pid) {
+          continue;
+        }
+        pid = 0;
+        --running;
+        if (ok && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+          ok = false;
+          kill_all(pids);
+        }
+      }
+      if (running > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    return ok;
+  }
+
+ private:
+  static void kill_all(const vector<pid_t>& pids) {
+    for (auto pid : pids) {
+      if (pid > 0) {
+        kill(pid, SIGKILL);
+      }
+    }
+  }
+
+  size_t _ranks;
+  size_t _slot_size;
+  SharedSegment _segment;
+};
+
+// Trains `model` with `optimizer` for `epochs` passes over x and y in
+// minibatches of `batch` rows on `ranks` processes. Every process starts
+// from the forked copy of the model and the optimizer, runs its shard of
+// each minibatch (see shard_backward), all-reduces its grads together with
+// the step's loss and accuracy through its slot, and applies the same
+// update. Rank 0 hands the final weights back to `model`; the optimizer's
+// state in the caller is left as it was. Returns the stats of every epoch,
+// empty when a process failed.
+inline vector<TrainStats> train_processes(size_t ranks, MLP& model,
+                                          optim::Optimizer& optimizer,
+                                          const Tensor& x, const Tensor& y,
+                                          size_t batch, size_t epochs,
+                                          const LossFn& loss_fn = loss::hinge) {
+  auto params = model.parameters();
+  auto n = params.numel();
+  ProcessGroup group{ranks, n + 2 * std::max<size_t>(epochs, 1)};
+  if (!group) {
+    return {};
+  }
+  auto ok = group.run([&](ShmCommunicator& comm) {
+    vector<TrainStats> stats(epochs);
+    auto slot = comm.slot();
+    for (size_t epoch = 0; epoch < epochs; ++epoch) {
+      for (size_t begin = 0; begin < x.rows(); begin += batch) {
+        auto end = std::min(x.rows(), begin + batch);
+        optimizer.zero_grad();
+        auto shard = shard_backward(model, loss_fn, x, y, begin, end,
+                                    comm.rank(), comm.ranks());
+        std::memcpy(slot, params.grad(), n * sizeof(double));
+        slot[n] = shard.loss;
+        slot[n + 1] = shard.accuracy;
+        comm.all_reduce(n + 2);
+        std::memcpy(params.grad(), slot, n * sizeof(double));
+        optimizer.step();
+        auto weight = static_cast<double>(end - begin) / x.rows();
+        stats[epoch].loss += weight * slot[n];
+        stats[epoch].accuracy += weight * slot[n + 1];
+      }
+    }
+    if (comm.rank() == 0) {
+      std::memcpy(slot, params.data(), n * sizeof(double));
+      for (size_t epoch = 0; epoch < epochs; ++epoch) {
+        slot[n + 2 * epoch] = stats[epoch].loss;
+        slot[n + 2 * epoch + 1] = stats[epoch].accuracy;
+      }
+    }
+    return 0;
+  });
+  if (!ok) {
+    return {};
+  }
+  auto result = group.communicator(0).slot(0);
+  std::memcpy(params.data(), result, n * sizeof(double));
+  vector<TrainStats> stats(epochs);
+  for (size_t epoch = 0; epoch < epochs; ++epoch) {
+    stats[epoch] = {result[n + 2 * epoch], result[n + 2 * epoch + 1]};
+  }
+  return stats;
+}
+
+}  // namespace ugrad
+#endif  // __UGRAD_MULTIPROCESS_HPP__
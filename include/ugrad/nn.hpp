@@ -1,7 +1,10 @@
 #ifndef __UGRAD_NN_HPP__
 #define __UGRAD_NN_HPP__
 
+#include <algorithm>
+#include <cstring>
 #include <initializer_list>
+#include <memory>
 #include <random>
 #include <vector>
 #include <string>
@@ -11,20 +14,94 @@
 
 namespace ugrad {
 
+// View of the parameters of a module: its tensor leaves in order, whose data
+// and grads are laid out back to back as one contiguous range each, so the
+// whole model can be swept like a single array. The view shares the list of
+// leaves with the module, which can be moved or destroyed while it is alive.
+class ParameterView {
+ public:
+  ParameterView(std::shared_ptr<const vector<ValuePtr>> params, size_t numel)
+      : _params{std::move(params)}, _numel{numel} {}
+
+  const ValuePtr* begin() const { return _params->data(); }
+  const ValuePtr* end() const { return _params->data() + _params->size(); }
+  const ValuePtr& operator[](size_t i) const { return (*_params)[i]; }
+  size_t size() const { return _params->size(); }
+  bool empty() const { return _params->empty(); }
+
+  // entries over all tensors, the length of data() and grad()
+  size_t numel() const { return _numel; }
+  double* data() const { return empty() ? nullptr : front().data(); }
+  double* grad() const { return empty() ? nullptr : front().grad(); }
+  void zero_grad() const {
+    if (_numel) {
+      std::memset(grad(), 0, _numel * sizeof(double));
+    }
+  }
+
+ private:
+  Tensor& front() const { return (*_params)[0]->tensor(); }
+
+  std::shared_ptr<const vector<ValuePtr>> _params;
+  size_t _numel;
+};
+
+// coefficient * the sum of squares of all parameters; its backward is one
+// axpy over the grad buffer
+inline ValuePtr l2_penalty(const ParameterView& params,
+                           double coefficient = 1.0) {
+  return l2_penalty(vector<ValuePtr>(params.begin(), params.end()),
+                    coefficient);
+}
+
+// Base of the layers and models. A module registers its tensor leaves with
+// set_parameters(), which moves them into one fresh ParameterBuffer; a model
+// registers the parameters of its submodules in their order, so every
+// submodule's range stays contiguous inside the model's buffer.
 struct Module {
   virtual ~Module() {}
-  void zero_grad() {
-    for (auto p: parameters()) {
-      p->_grad = 0;
+  ParameterView parameters() const { return {_params, _numel}; }
+  void zero_grad() { parameters().zero_grad(); }
+
+ protected:
+  void set_parameters(vector<ValuePtr> params) {
+    size_t numel = 0;
+    for (auto& p : params) {
+      numel += p->tensor().size();
     }
+    auto buffer = std::make_shared<ParameterBuffer>(numel);
+    size_t offset = 0;
+    for (auto& p : params) {
+      p->tensor().bind(buffer, offset);
+      offset += p->tensor().size();
+    }
+    _params = std::make_shared<const vector<ValuePtr>>(std::move(params));
+    _numel = numel;
   }
-  virtual vector<ValuePtr> parameters() { return {}; }
+
+  // the parameters of the submodules, back to back
+  template <typename Modules>
+  static void append_parameters(const Modules& modules,
+                                vector<ValuePtr>& params) {
+    for (auto& module : modules) {
+      auto view = module.parameters();
+      params.insert(params.end(), view.begin(), view.end());
+    }
+  }
+
+  // shared with the views, a module's list never changes once set
+  std::shared_ptr<const vector<ValuePtr>> _params =
+      std::make_shared<const vector<ValuePtr>>();
+  size_t _numel = 0;
 };
 
+// The weights and the bias of a neuron are one contiguous [1 x (in + 1)]
+// tensor leaf, the bias last, and its forward is a single Op::Neuron node.
 struct Neuron : public Module {
   Neuron(size_t in_nr, bool non_linear = true, bool is_test = false)
-      : _w{}, _b{make_shared<Value>(0.0)}, _non_linear{non_linear} {
+      : _in_nr{in_nr}, _non_linear{non_linear} {
     fill_weights(in_nr, !is_test);
+    set_parameters({_w});
   }
   ~Neuron() {}
 
@@ -37,42 +114,34 @@ struct Neuron : public Module {
 
   void fill_weights(size_t num, bool use_random) {
     auto gen = UniformRandomGenerator();
+    vector<double> w(num + 1, 1.0);
     for (auto i = 0; i < num; ++i) {
-      auto val = 1.0;
       if (use_random) {
-        val = gen();
+        w[i] = gen();
       }
-      _w.emplace_back(make_shared<Value>(val));
     }
+    w[num] = 0.0;
+    _w = make_tensor(1, num + 1, std::move(w));
   }
 
-  ValuePtr operator()(vector<ValuePtr> x) {
-    auto wx = x[0] * _w[0];
-    for (auto i = 1; i < x.size(); ++i) {
-      wx = wx + (x[i] * _w[i]);
-    }
-    auto act = wx + _b;
-    if (_non_linear) {
-      return act->relu();
-    }
-    return act;
+  ValuePtr operator()(const vector<ValuePtr>& x) {
+    return neuron(_w, x, _non_linear);
+  }
+
+  // a [batch x in] tensor node, one output per sample in a [batch x 1] node
+  ValuePtr operator()(const ValuePtr& x) {
+    return dense(x, {_w}, _non_linear);
   }
 
   friend ostream& operator<<(ostream& os, const Neuron& val) {
     auto act = "Linear";
     if (val._non_linear) { act = "ReLU"; }
-    os << act << "Neuron(" << val._w.size() << ")";
+    os << act << "Neuron(" << val._in_nr << ")";
     return os;
   }
 
-  vector<ValuePtr> parameters() {
-    auto whole = _w;
-    whole.push_back(_b);
-    return whole;
-  }
-
-  vector<ValuePtr> _w;
-  ValuePtr _b;
+  size_t _in_nr;
+  ValuePtr _w;
   bool _non_linear;
 };
 
@@ -81,6 +150,9 @@ struct Layer : public Module {
         bool is_test = false)
       : _in_nr{in_nr}, _out_nr{out_nr}, _neurons{} {
     fill_neurons(non_linear, is_test);
+    vector<ValuePtr> params;
+    append_parameters(_neurons, params);
+    set_parameters(std::move(params));
   }
   ~Layer() {}
 
@@ -90,14 +162,43 @@ struct Layer : public Module {
     }
   }
 
+  // Neurons are evaluated concurrently on the default pool, in chunks of at
+  // least kMinParallelWork weights so small layers stay on the calling
+  // thread. The caller's grad mode carries over to the threads that help.
   vector<ValuePtr> operator()(vector<ValuePtr> x) {
-    auto out = vector<ValuePtr>{};
-    for (auto neuron : _neurons) {
-      out.emplace_back(neuron(x));
+    auto out = vector<ValuePtr>(_neurons.size());
+#ifdef UGRAD_INTRUSIVE_PTR
+    // non-atomic handles, the graph has to be built on one thread
+    for (size_t i = 0; i < _neurons.size(); ++i) {
+      out[i] = _neurons[i](x);
     }
+#else
+    auto grad_enabled = GradMode::is_enabled();
+    auto grain =
+        std::max<size_t>(kMinParallelWork / std::max<size_t>(_in_nr, 1), 1);
+    parallel_for(*default_pool(), 0, _neurons.size(), [&](size_t i) {
+      auto prev = GradMode::is_enabled();
+      GradMode::set_enabled(grad_enabled);
+      out[i] = _neurons[i](x);
+      GradMode::set_enabled(prev);
+    }, grain);
+#endif
     return out;
   }
 
+  // A [batch x in] tensor node through all neurons as one Op::Dense node,
+  // the result is [batch x out]: the neuron rows are stacked into a matrix
+  // and the whole batch goes through one gemm.
+  ValuePtr operator()(const ValuePtr& x) {
+    assert(!_neurons.empty());
+    vector<ValuePtr> rows;
+    rows.reserve(_neurons.size());
+    for (auto& neuron : _neurons) {
+      rows.push_back(neuron._w);
+    }
+    return dense(x, rows, _neurons[0]._non_linear);
+  }
+
   friend ostream& operator<<(ostream& os, const Layer& layer) {
     std::string str = "Layer of[";
     for (auto& n: layer._neurons) {
@@ -112,42 +213,112 @@ struct Layer : public Module {
   }
 
 
-  vector<ValuePtr> parameters() {
-    vector<ValuePtr> whole;
-    for (auto neuron: _neurons) {
-      for (auto param: neuron.parameters()) {
-        whole.push_back(param);
-      }
+  static constexpr size_t kMinParallelWork = 4096;
+
+  size_t _in_nr;
+  size_t _out_nr;
+  vector<Neuron> _neurons;
+};
+
+// Fully connected layer over a batch. The weights are one contiguous
+// row-major [in x out] tensor and the bias one [1 x out] row, the forward of a
+// [batch x in] input is a single Op::Linear or Op::LinearRelu node instead
+// of 2 * in * out scalar nodes per sample.
+struct Linear : public Module {
+  Linear(size_t in_nr, size_t out_nr, bool non_linear = true,
+         bool is_test = false)
+      : _in_nr{in_nr}, _out_nr{out_nr}, _non_linear{non_linear} {
+    auto gen = Neuron::UniformRandomGenerator();
+    vector<double> w(in_nr * out_nr, 1.0);
+    if (!is_test) {
+      std::generate(w.begin(), w.end(), gen);
     }
-    return whole;
+    _w = make_tensor(in_nr, out_nr, std::move(w));
+    _b = make_tensor(1, out_nr);
+    set_parameters({_w, _b});
+  }
+
+  // x is a [batch x in] tensor node, the result is [batch x out]
+  ValuePtr operator()(const ValuePtr& x) {
+    return linear(x, _w, _b, _non_linear);
+  }
+
+  friend ostream& operator<<(ostream& os, const Linear& linear) {
+    os << (linear._non_linear ? "ReLU" : "Linear") << "Linear("
+       << linear._in_nr << ", " << linear._out_nr << ")";
+    return os;
   }
 
   size_t _in_nr;
   size_t _out_nr;
-  vector<Neuron> _neurons;
+  bool _non_linear;
+  ValuePtr _w;
+  ValuePtr _b;
 };
 
+// Neurons builds the MLP from scalar Layers, Linear from tensor-backed
+// Linear layers that evaluate a whole batch per node.
+enum class LayerKind { Neurons, Linear };
+
 struct MLP : public Module {
-  MLP(size_t in_nr, std::vector<size_t> outs_nr, bool is_test = false) : _layers() {
+  MLP(size_t in_nr, std::vector<size_t> outs_nr, bool is_test = false)
+      : MLP(in_nr, std::move(outs_nr), LayerKind::Neurons, is_test) {}
+  MLP(size_t in_nr, std::vector<size_t> outs_nr, LayerKind kind,
+      bool is_test = false) : _layers() {
     vector<size_t> sz(outs_nr.begin(), outs_nr.end());
     sz.insert(sz.begin(), in_nr);
-    for (auto i = 0; i < outs_nr.size(); ++i) {
-      _layers.emplace_back(sz[i], sz[i + 1], i != (outs_nr.size() - 1),
-                           is_test);
+    for (size_t i = 0; i < outs_nr.size(); ++i) {
+      auto non_linear = i != (outs_nr.size() - 1);
+      if (kind == LayerKind::Linear) {
+        _linears.emplace_back(sz[i], sz[i + 1], non_linear, is_test);
+      } else {
+        _layers.emplace_back(sz[i], sz[i + 1], non_linear, is_test);
+      }
     }
+    vector<ValuePtr> params;
+    append_parameters(_layers, params);
+    append_parameters(_linears, params);
+    set_parameters(std::move(params));
   }
-  MLP(size_t in_nr, std::initializer_list<size_t> outs_nr, bool is_test = false)
-    : MLP(in_nr, std::vector<size_t>{outs_nr}, is_test) {
+  template <typename T>
+  MLP(size_t in_nr, std::initializer_list<T> outs_nr, bool is_test = false)
+    : MLP(in_nr, std::vector<size_t>(outs_nr.begin(), outs_nr.end()), is_test) {
   }
+  template <typename T>
+  MLP(size_t in_nr, std::initializer_list<T> outs_nr, LayerKind kind,
+      bool is_test = false)
+    : MLP(in_nr, std::vector<size_t>(outs_nr.begin(), outs_nr.end()), kind,
+          is_test) {}
   ~MLP() {}
 
+  // One sample. Linear layers see it as a batch of one row.
   vector<ValuePtr> operator()(vector<ValuePtr> x) {
-    for (auto layer : _layers) {
+    if (!_linears.empty()) {
+      auto y = (*this)(stack(x));
+      vector<ValuePtr> out;
+      for (size_t j = 0; j < y->tensor().cols(); ++j) {
+        out.push_back(element(y, 0, j));
+      }
+      return out;
+    }
+    for (auto& layer : _layers) {
       x = layer(x);
     }
     return x;
   }
 
+  // A [batch x in] tensor node, one node per layer, the result is
+  // [batch x out] with a row per sample.
+  ValuePtr operator()(ValuePtr x) {
+    for (auto& layer : _layers) {
+      x = layer(x);
+    }
+    for (auto& linear : _linears) {
+      x = linear(x);
+    }
+    return x;
+  }
+
   friend ostream& operator<<(ostream& os, const MLP& mlp) {
     std::string str = "MLP of[";
     for (auto& layer: mlp._layers) {
@@ -155,23 +326,19 @@ struct MLP : public Module {
       ss << layer;
       str += ss.str() + ", ";
     }
+    for (auto& linear: mlp._linears) {
+      std::stringstream ss;
+      ss << linear;
+      str += ss.str() + ", ";
+    }
     str = str.substr(0, str.size() - 2);
     str += "]";
     os << str;
     return os;
   }
 
-  vector<ValuePtr> parameters() {
-    vector<ValuePtr> whole;
-    for (auto layer: _layers) {
-      for (auto param: layer.parameters()) {
-        whole.push_back(param);
-      }
-    }
-    return whole;
-  }
-
   vector<Layer> _layers;
+  vector<Linear> _linears;
 };
 
 }  // namespace ugrad
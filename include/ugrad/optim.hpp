@@ -0,0 +1,423 @@
+#ifndef __UGRAD_OPTIM_HPP__
+#define __UGRAD_OPTIM_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <ugrad/nn.hpp>
+#include <ugrad/simd.hpp>
+#include <ugrad/thread_pool.hpp>
+
+namespace ugrad {
+namespace optim {
+
+// Update rules over the flat parameter range of a module (see ParameterView).
+// A step is one pass over the data, grad and state arrays with every
+// per-element operation fused into a single loop, vectorized with AVX-512 or
+// AVX2 when the CPU has them and split over the default pool for large
+// models.
+//
+// Every optimizer takes a weight decay, either coupled, the L2 form added to
+// the gradient, or decoupled as in AdamW: p is scaled by 1 - lr * decay
+// before the update, without going through momentum or the moments.
+
+// Hyperparameters of one step, as the kernels read them. `weight_decay` is
+// added to the grad as weight_decay * p, `decay` scales p before the update;
+// one of them is the identity.
+struct SGDStep {
+  double lr;
+  double momentum;
+  double weight_decay;
+  double decay;
+  bool nesterov;
+};
+
+struct AdamStep {
+  // lr over the first moment's bias correction
+  double step_size;
+  double beta1;
+  double beta2;
+  double eps;
+  // 1 / sqrt of the second moment's bias correction
+  double inv_sqrt_bias2;
+  double weight_decay;
+  double decay;
+};
+
+struct RMSPropStep {
+  double lr;
+  double alpha;
+  double eps;
+  double weight_decay;
+  double decay;
+};
+
+// Each kernel updates the elements [begin, end); `buf`, the momentum
+// buffer, is null without momentum.
+inline void sgd_scalar(const SGDStep& s, size_t begin, size_t end, double* p,
+                       const double* g, double* buf) {
+  for (auto i = begin; i < end; ++i) {
+    auto d = g[i] + s.weight_decay * p[i];
+    if (buf) {
+      buf[i] = s.momentum * buf[i] + d;
+      d = s.nesterov ? d + s.momentum * buf[i] : buf[i];
+    }
+    p[i] = s.decay * p[i] - s.lr * d;
+  }
+}
+
+inline void adam_scalar(const AdamStep& s, size_t begin, size_t end,
+                        double* p, const double* g, double* m, double* v) {
+  for (auto i = begin; i < end; ++i) {
+    auto grad = g[i] + s.weight_decay * p[i];
+    m[i] = s.beta1 * m[i] + (1.0 - s.beta1) * grad;
+    v[i] = s.beta2 * v[i] + (1.0 - s.beta2) * grad * grad;
+    p[i] = s.decay * p[i] -
+           s.step_size * m[i] / (std::sqrt(v[i]) * s.inv_sqrt_bias2 + s.eps);
+  }
+}
+
+inline void rmsprop_scalar(const RMSPropStep& s, size_t begin, size_t end,
+                           double* p, const double* g, double* v) {
+  for (auto i = begin; i < end; ++i) {
+    auto grad = g[i] + s.weight_decay * p[i];
+    v[i] = s.alpha * v[i] + (1.0 - s.alpha) * grad * grad;
+    p[i] = s.decay * p[i] - s.lr * grad / (std::sqrt(v[i]) + s.eps);
+  }
+}
+
+#ifdef UGRAD_SIMD_X86
+__attribute__((target("avx2,fma"))) inline void sgd_avx2(
+    const SGDStep& s, size_t begin, size_t end, double* p, const double* g,
+    double* buf) {
+  auto lr = _mm256_set1_pd(s.lr);
+  auto mu = _mm256_set1_pd(s.momentum);
+  auto wd = _mm256_set1_pd(s.weight_decay);
+  auto decay = _mm256_set1_pd(s.decay);
+  auto i = begin;
+  for (; i + 4 <= end; i += 4) {
+    auto vp = _mm256_loadu_pd(p + i);
+    auto d = _mm256_fmadd_pd(wd, vp, _mm256_loadu_pd(g + i));
+    if (buf) {
+      auto b = _mm256_fmadd_pd(mu, _mm256_loadu_pd(buf + i), d);
+      _mm256_storeu_pd(buf + i, b);
+      d = s.nesterov ? _mm256_fmadd_pd(mu, b, d) : b;
+    }
+    auto decayed = _mm256_mul_pd(decay, vp);
+    _mm256_storeu_pd(p + i, _mm256_fnmadd_pd(lr, d, decayed));
+  }
+  sgd_scalar(s, i, end, p, g, buf);
+}
+
+__attribute__((target("avx2,fma"))) inline void adam_avx2(
+    const AdamStep& s, size_t begin, size_t end, double* p, const double* g,
+    double* m, double* v) {
+  auto step_size = _mm256_set1_pd(s.step_size);
+  auto b1 = _mm256_set1_pd(s.beta1), c1 = _mm256_set1_pd(1.0 - s.beta1);
+  auto b2 = _mm256_set1_pd(s.beta2), c2 = _mm256_set1_pd(1.0 - s.beta2);
+  auto eps = _mm256_set1_pd(s.eps);
+  auto bias2 = _mm256_set1_pd(s.inv_sqrt_bias2);
+  auto wd = _mm256_set1_pd(s.weight_decay);
+  auto decay = _mm256_set1_pd(s.decay);
+  auto i = begin;
+  for (; i + 4 <= end; i += 4) {
+    auto vp = _mm256_loadu_pd(p + i);
+    auto grad = _mm256_fmadd_pd(wd, vp, _mm256_loadu_pd(g + i));
+    auto vm = _mm256_fmadd_pd(b1, _mm256_loadu_pd(m + i),
+                              _mm256_mul_pd(c1, grad));
+    auto vv = _mm256_fmadd_pd(b2, _mm256_loadu_pd(v + i),
+                              _mm256_mul_pd(c2, _mm256_mul_pd(grad, grad)));
+    _mm256_storeu_pd(m + i, vm);
+    _mm256_storeu_pd(v + i, vv);
+    auto denom = _mm256_fmadd_pd(_mm256_sqrt_pd(vv), bias2, eps);
+    auto update = _mm256_div_pd(_mm256_mul_pd(step_size, vm), denom);
+    _mm256_storeu_pd(p + i, _mm256_fmsub_pd(decay, vp, update));
+  }
+  adam_scalar(s, i, end, p, g, m, v);
+}
+
+__attribute__((target("avx2,fma"))) inline void rmsprop_avx2(
+    const RMSPropStep& s, size_t begin, size_t end, double* p,
+    const double* g, double* v) {
+  auto lr = _mm256_set1_pd(s.lr);
+  auto a = _mm256_set1_pd(s.alpha), c = _mm256_set1_pd(1.0 - s.alpha);
+  auto eps = _mm256_set1_pd(s.eps);
+  auto wd = _mm256_set1_pd(s.weight_decay);
+  auto decay = _mm256_set1_pd(s.decay);
+  auto i = begin;
+  for (; i + 4 <= end; i += 4) {
+    auto vp = _mm256_loadu_pd(p + i);
+    auto grad = _mm256_fmadd_pd(wd, vp, _mm256_loadu_pd(g + i));
+    auto vv = _mm256_fmadd_pd(a, _mm256_loadu_pd(v + i),
+                              _mm256_mul_pd(c, _mm256_mul_pd(grad, grad)));
+    _mm256_storeu_pd(v + i, vv);
+    auto denom = _mm256_add_pd(_mm256_sqrt_pd(vv), eps);
+    auto update = _mm256_div_pd(_mm256_mul_pd(lr, grad), denom);
+    _mm256_storeu_pd(p + i, _mm256_fmsub_pd(decay, vp, update));
+  }
+  rmsprop_scalar(s, i, end, p, g, v);
+}
+
+__attribute__((target("avx512f"))) inline void sgd_avx512(
+    const SGDStep& s, size_t begin, size_t end, double* p, const double* g,
+    double* buf) {
+  auto lr = _mm512_set1_pd(s.lr);
+  auto mu = _mm512_set1_pd(s.momentum);
+  auto wd = _mm512_set1_pd(s.weight_decay);
+  auto decay = _mm512_set1_pd(s.decay);
+  auto i = begin;
+  for (; i + 8 <= end; i += 8) {
+    auto vp = _mm512_loadu_pd(p + i);
+    auto d = _mm512_fmadd_pd(wd, vp, _mm512_loadu_pd(g + i));
+    if (buf) {
+      auto b = _mm512_fmadd_pd(mu, _mm512_loadu_pd(buf + i), d);
+      _mm512_storeu_pd(buf + i, b);
+      d = s.nesterov ? _mm512_fmadd_pd(mu, b, d) : b;
+    }
+    auto decayed = _mm512_mul_pd(decay, vp);
+    _mm512_storeu_pd(p + i, _mm512_fnmadd_pd(lr, d, decayed));
+  }
+  sgd_scalar(s, i, end, p, g, buf);
+}
+
+// _mm512_sqrt_pd passes an undefined vector and trips -Wuninitialized with
+// GCC 12, the zero-masked form over all lanes does not
+__attribute__((target("avx512f"))) inline __m512d sqrt_avx512(__m512d x) {
+  return _mm512_maskz_sqrt_pd(0xFF, x);
+}
+
+__attribute__((target("avx512f"))) inline void adam_avx512(
+    const AdamStep& s, size_t begin, size_t end, double* p, const double* g,
+    double* m, double* v) {
+  auto step_size = _mm512_set1_pd(s.step_size);
+  auto b1 = _mm512_set1_pd(s.beta1), c1 = _mm512_set1_pd(1.0 - s.beta1);
+  auto b2 = _mm512_set1_pd(s.beta2), c2 = _mm512_set1_pd(1.0 - s.beta2);
+  auto eps = _mm512_set1_pd(s.eps);
+  auto bias2 = _mm512_set1_pd(s.inv_sqrt_bias2);
+  auto wd = _mm512_set1_pd(s.weight_decay);
+  auto decay = _mm512_set1_pd(s.decay);
+  auto i = begin;
+  for (; i + 8 <= end; i += 8) {
+    auto vp = _mm512_loadu_pd(p + i);
+    auto grad = _mm512_fmadd_pd(wd, vp, _mm512_loadu_pd(g + i));
+    auto vm = _mm512_fmadd_pd(b1, _mm512_loadu_pd(m + i),
+                              _mm512_mul_pd(c1, grad));
+    auto vv = _mm512_fmadd_pd(b2, _mm512_loadu_pd(v + i),
+                              _mm512_mul_pd(c2, _mm512_mul_pd(grad, grad)));
+    _mm512_storeu_pd(m + i, vm);
+    _mm512_storeu_pd(v + i, vv);
+    auto denom = _mm512_fmadd_pd(sqrt_avx512(vv), bias2, eps);
+    auto update = _mm512_div_pd(_mm512_mul_pd(step_size, vm), denom);
+    _mm512_storeu_pd(p + i, _mm512_fmsub_pd(decay, vp, update));
+  }
+  adam_scalar(s, i, end, p, g, m, v);
+}
+
+__attribute__((target("avx512f"))) inline void rmsprop_avx512(
+    const RMSPropStep& s, size_t begin, size_t end, double* p,
+    const double* g, double* v) {
+  auto lr = _mm512_set1_pd(s.lr);
+  auto a = _mm512_set1_pd(s.alpha), c = _mm512_set1_pd(1.0 - s.alpha);
+  auto eps = _mm512_set1_pd(s.eps);
+  auto wd = _mm512_set1_pd(s.weight_decay);
+  auto decay = _mm512_set1_pd(s.decay);
+  auto i = begin;
+  for (; i + 8 <= end; i += 8) {
+    auto vp = _mm512_loadu_pd(p + i);
+    auto grad = _mm512_fmadd_pd(wd, vp, _mm512_loadu_pd(g + i));
+    auto vv = _mm512_fmadd_pd(a, _mm512_loadu_pd(v + i),
+                              _mm512_mul_pd(c, _mm512_mul_pd(grad, grad)));
+    _mm512_storeu_pd(v + i, vv);
+    auto denom = _mm512_add_pd(sqrt_avx512(vv), eps);
+    auto update = _mm512_div_pd(_mm512_mul_pd(lr, grad), denom);
+    _mm512_storeu_pd(p + i, _mm512_fmsub_pd(decay, vp, update));
+  }
+  rmsprop_scalar(s, i, end, p, g, v);
+}
+
+// the kernel of each update rule for the dispatched vector ISA
+template <typename Kernel>
+Kernel select_kernel(Kernel scalar, Kernel avx2, Kernel avx512) {
+  switch (vector_isa()) {
+    case SimdIsa::AVX512:
+      return avx512;
+    case SimdIsa::AVX2:
+      return avx2;
+    default:
+      return scalar;
+  }
+}
+#endif
+
+// Base of the optimizers. The ParameterView points into the module, which
+// has to outlive the optimizer.
+class Optimizer {
+ public:
+  Optimizer(ParameterView params, double lr, double weight_decay = 0.0,
+            bool decoupled = false)
+      : _params{params},
+        _lr{lr},
+        _weight_decay{weight_decay},
+        _decoupled{decoupled} {}
+  virtual ~Optimizer() {}
+
+  virtual void step() = 0;
+  void zero_grad() { _params.zero_grad(); }
+
+  double lr() const { return _lr; }
+  void set_lr(double lr) { _lr = lr; }
+  double weight_decay() const { return _weight_decay; }
+  bool decoupled() const { return _decoupled; }
+  // steps taken so far
+  size_t steps() const { return _steps; }
+
+  // below this many parameters a step runs on the calling thread
+  static constexpr size_t kMinParallelWork = 1 << 16;
+
+ protected:
+  // Calls kernel(begin, end) over the whole parameter range, in chunks on
+  // the default pool for large models.
+  template <typename Kernel>
+  void sweep(Kernel&& kernel) {
+    auto n = _params.numel();
+    if (n < kMinParallelWork) {
+      kernel(size_t{0}, n);
+      return;
+    }
+    constexpr size_t chunk = kMinParallelWork / 4;
+    parallel_for(*default_pool(), 0, (n + chunk - 1) / chunk, [&](size_t c) {
+      kernel(c * chunk, std::min(n, (c + 1) * chunk));
+    });
+  }
+
+  // the weight decay of a step as the kernels apply it, see SGDStep
+  double coupled_decay() const { return _decoupled ? 0.0 : _weight_decay; }
+  double decay() const { return _decoupled ? 1.0 - _lr * _weight_decay : 1.0; }
+
+  ParameterView _params;
+  double _lr;
+  double _weight_decay;
+  bool _decoupled;
+  size_t _steps = 0;
+};
+
+// Stochastic gradient descent with optional (Nesterov) momentum:
+// b = momentum * b + g, p -= lr * (nesterov ? g + momentum * b : b).
+class SGD : public Optimizer {
+ public:
+  SGD(ParameterView params, double lr, double momentum = 0.0,
+      bool nesterov = false, double weight_decay = 0.0,
+      bool decoupled = false)
+      : Optimizer{params, lr, weight_decay, decoupled},
+        _momentum{momentum},
+        _nesterov{nesterov},
+        _velocity(momentum != 0.0 ? params.numel() : 0) {}
+
+  void step() override {
+    ++_steps;
+    SGDStep s{_lr, _momentum, coupled_decay(), decay(), _nesterov};
+#ifdef UGRAD_SIMD_X86
+    auto kernel = select_kernel(sgd_scalar, sgd_avx2, sgd_avx512);
+#else
+    auto kernel = sgd_scalar;
+#endif
+    auto p = _params.data();
+    auto g = _params.grad();
+    auto buf = _velocity.empty() ? nullptr : _velocity.data();
+    sweep([&](size_t begin, size_t end) { kernel(s, begin, end, p, g, buf); });
+  }
+
+ private:
+  double _momentum;
+  bool _nesterov;
+  vector<double> _velocity;
+};
+
+// Adam with bias-corrected first and second moments.
+class Adam : public Optimizer {
+ public:
+  Adam(ParameterView params, double lr = 1e-3, double beta1 = 0.9,
+       double beta2 = 0.999, double eps = 1e-8, double weight_decay = 0.0,
+       bool decoupled = false)
+      : Optimizer{params, lr, weight_decay, decoupled},
+        _beta1{beta1},
+        _beta2{beta2},
+        _eps{eps},
+        _m(params.numel()),
+        _v(params.numel()) {}
+
+  void step() override {
+    ++_steps;
+    auto t = static_cast<double>(_steps);
+    AdamStep s;
+    s.step_size = _lr / (1.0 - std::pow(_beta1, t));
+    s.beta1 = _beta1;
+    s.beta2 = _beta2;
+    s.eps = _eps;
+    s.inv_sqrt_bias2 = 1.0 / std::sqrt(1.0 - std::pow(_beta2, t));
+    s.weight_decay = coupled_decay();
+    s.decay = decay();
+#ifdef UGRAD_SIMD_X86
+    auto kernel = select_kernel(adam_scalar, adam_avx2, adam_avx512);
+#else
+    auto kernel = adam_scalar;
+#endif
+    auto p = _params.data();
+    auto g = _params.grad();
+    auto m = _m.data();
+    auto v = _v.data();
+    sweep([&](size_t begin, size_t end) { kernel(s, begin, end, p, g, m, v); });
+  }
+
+ private:
+  double _beta1;
+  double _beta2;
+  double _eps;
+  vector<double> _m;
+  vector<double> _v;
+};
+
+// Adam with decoupled weight decay, on by default.
+class AdamW : public Adam {
+ public:
+  AdamW(ParameterView params, double lr = 1e-3, double beta1 = 0.9,
+        double beta2 = 0.999, double eps = 1e-8, double weight_decay = 1e-2)
+      : Adam{params, lr, beta1, beta2, eps, weight_decay, true} {}
+};
+
+// RMSProp: v = alpha * v + (1 - alpha) * g^2, p -= lr * g / (sqrt(v) + eps).
+class RMSProp : public Optimizer {
+ public:
+  RMSProp(ParameterView params, double lr = 1e-2, double alpha = 0.99,
+          double eps = 1e-8, double weight_decay = 0.0,
+          bool decoupled = false)
+      : Optimizer{params, lr, weight_decay, decoupled},
+        _alpha{alpha},
+        _eps{eps},
+        _v(params.numel()) {}
+
+  void step() override {
+    ++_steps;
+    RMSPropStep s{_lr, _alpha, _eps, coupled_decay(), decay()};
+#ifdef UGRAD_SIMD_X86
+    auto kernel = select_kernel(rmsprop_scalar, rmsprop_avx2, rmsprop_avx512);
+#else
+    auto kernel = rmsprop_scalar;
+#endif
+    auto p = _params.data();
+    auto g = _params.grad();
+    auto v = _v.data();
+    sweep([&](size_t begin, size_t end) { kernel(s, begin, end, p, g, v); });
+  }
+
+ private:
+  double _alpha;
+  double _eps;
+  vector<double> _v;
+};
+
+}  // namespace optim
+}  // namespace ugrad
+#endif  // __UGRAD_OPTIM_HPP__
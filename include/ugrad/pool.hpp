@@ -0,0 +1,70 @@
+#ifndef __UGRAD_POOL_HPP__
+#define __UGRAD_POOL_HPP__
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace ugrad {
+
+// Allocator that recycles single-object blocks through a per-thread free
+// list, so short-lived nodes created with std::allocate_shared reuse the
+// memory of the previous ones instead of going back to malloc every time.
+// A block freed on another thread simply joins that thread's list.
+template <typename T>
+struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    auto& blocks = free_list()._blocks;
+    if (n == 1 && !free_list()._closed && !blocks.empty()) {
+      auto block = blocks.back();
+      blocks.pop_back();
+      return static_cast<T*>(block);
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    auto& blocks = free_list()._blocks;
+    if (n == 1 && !free_list()._closed && blocks.size() < kMaxFree) {
+      blocks.push_back(ptr);
+      return;
+    }
+    ::operator delete(ptr);
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>&) const { return false; }
+
+ private:
+  // upper bound on the blocks a thread keeps around for reuse
+  static constexpr size_t kMaxFree = 1 << 16;
+
+  struct FreeList {
+    ~FreeList() {
+      for (auto block : _blocks) {
+        ::operator delete(block);
+      }
+      _blocks.clear();
+      // nodes released by later thread_local or static destructors
+      _closed = true;
+    }
+    std::vector<void*> _blocks;
+    bool _closed = false;
+  };
+
+  static FreeList& free_list() {
+    static thread_local FreeList list;
+    return list;
+  }
+};
+
+}  // namespace ugrad
+#endif  // __UGRAD_POOL_HPP__
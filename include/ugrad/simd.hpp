@@ -0,0 +1,225 @@
+#ifndef __UGRAD_SIMD_HPP__
+#define __UGRAD_SIMD_HPP__
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UGRAD_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace ugrad {
+
+// Vector instruction sets the kernels are written for. Each kernel family
+// picks the best one the CPU supports at runtime, so the library is built for
+// the baseline target and still runs AVX code where it is available.
+enum class SimdIsa { Scalar, SSE2, AVX2, AVX512 };
+
+inline bool simd_supports(SimdIsa isa) {
+  switch (isa) {
+    case SimdIsa::Scalar:
+      return true;
+#ifdef UGRAD_SIMD_X86
+    case SimdIsa::SSE2:
+      return true;
+    case SimdIsa::AVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SimdIsa::AVX512:
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+  }
+}
+
+inline SimdIsa best_simd_isa() {
+  for (auto isa : {SimdIsa::AVX512, SimdIsa::AVX2, SimdIsa::SSE2}) {
+    if (simd_supports(isa)) {
+      return isa;
+    }
+  }
+  return SimdIsa::Scalar;
+}
+
+// Level-1 kernels over contiguous arrays of n doubles. Four independent
+// accumulators hide the latency of the adds; SSE2 is left to the compiler's
+// autovectorization of the portable loops.
+inline double dot_scalar(size_t n, const double* x, const double* y) {
+  double acc[4] = {};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (size_t l = 0; l < 4; ++l) {
+      acc[l] += x[i + l] * y[i + l];
+    }
+  }
+  for (; i < n; ++i) {
+    acc[0] += x[i] * y[i];
+  }
+  return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+// y += alpha * x
+inline void axpy_scalar(size_t n, double alpha, const double* x, double* y) {
+  for (size_t i = 0; i < n; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+#ifdef UGRAD_SIMD_X86
+// sum of the four lanes
+__attribute__((target("avx"))) inline double hsum_avx(__m256d sum) {
+  auto half = _mm_add_pd(_mm256_castpd256_pd128(sum),
+                         _mm256_extractf128_pd(sum, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+__attribute__((target("avx2,fma"))) inline double dot_avx2(size_t n,
+                                                            const double* x,
+                                                            const double* y) {
+  __m256d acc[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(),
+                    _mm256_setzero_pd(), _mm256_setzero_pd()};
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    for (size_t l = 0; l < 4; ++l) {
+      acc[l] = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4 * l),
+                               _mm256_loadu_pd(y + i + 4 * l), acc[l]);
+    }
+  }
+  for (; i + 4 <= n; i += 4) {
+    acc[0] = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i),
+                             acc[0]);
+  }
+  double out = hsum_avx(_mm256_add_pd(_mm256_add_pd(acc[0], acc[1]),
+                                      _mm256_add_pd(acc[2], acc[3])));
+  for (; i < n; ++i) {
+    out += x[i] * y[i];
+  }
+  return out;
+}
+
+__attribute__((target("avx2,fma"))) inline void axpy_avx2(size_t n,
+                                                          double alpha,
+                                                          const double* x,
+                                                          double* y) {
+  auto a = _mm256_set1_pd(alpha);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i),
+                                            _mm256_loadu_pd(y + i)));
+    _mm256_storeu_pd(y + i + 4,
+                     _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i + 4),
+                                     _mm256_loadu_pd(y + i + 4)));
+  }
+  for (; i < n; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+// the tail is one masked step instead of a scalar loop
+__attribute__((target("avx512f"))) inline double dot_avx512(size_t n,
+                                                            const double* x,
+                                                            const double* y) {
+  __m512d acc[4] = {_mm512_setzero_pd(), _mm512_setzero_pd(),
+                    _mm512_setzero_pd(), _mm512_setzero_pd()};
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    for (size_t l = 0; l < 4; ++l) {
+      acc[l] = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8 * l),
+                               _mm512_loadu_pd(y + i + 8 * l), acc[l]);
+    }
+  }
+  for (; i + 8 <= n; i += 8) {
+    acc[0] = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i),
+                             acc[0]);
+  }
+  if (i < n) {
+    auto mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+    acc[1] = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, x + i),
+                             _mm512_maskz_loadu_pd(mask, y + i), acc[1]);
+  }
+  // Reduced by hand: _mm512_reduce_add_pd and the unmasked extracts pass an
+  // undefined vector and trip -Wuninitialized with GCC 12, the zero-masked
+  // extracts of both halves do not.
+  auto sum = _mm512_add_pd(_mm512_add_pd(acc[0], acc[1]),
+                           _mm512_add_pd(acc[2], acc[3]));
+  return hsum_avx(_mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xF, sum, 0),
+                                _mm512_maskz_extractf64x4_pd(0xF, sum, 1)));
+}
+
+__attribute__((target("avx512f"))) inline void axpy_avx512(size_t n,
+                                                           double alpha,
+                                                           const double* x,
+                                                           double* y) {
+  auto a = _mm512_set1_pd(alpha);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_pd(y + i, _mm512_fmadd_pd(a, _mm512_loadu_pd(x + i),
+                                            _mm512_loadu_pd(y + i)));
+    _mm512_storeu_pd(y + i + 8,
+                     _mm512_fmadd_pd(a, _mm512_loadu_pd(x + i + 8),
+                                     _mm512_loadu_pd(y + i + 8)));
+  }
+  for (; i + 8 <= n; i += 8) {
+    _mm512_storeu_pd(y + i, _mm512_fmadd_pd(a, _mm512_loadu_pd(x + i),
+                                            _mm512_loadu_pd(y + i)));
+  }
+  if (i < n) {
+    auto mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+    auto out = _mm512_fmadd_pd(a, _mm512_maskz_loadu_pd(mask, x + i),
+                               _mm512_maskz_loadu_pd(mask, y + i));
+    _mm512_mask_storeu_pd(y + i, mask, out);
+  }
+}
+#endif
+
+struct VectorKernels {
+  SimdIsa isa;
+  double (*dot)(size_t n, const double* x, const double* y);
+  void (*axpy)(size_t n, double alpha, const double* x, double* y);
+};
+
+inline const VectorKernels& vector_kernels(SimdIsa isa) {
+  static const VectorKernels kernels[] = {
+      {SimdIsa::Scalar, dot_scalar, axpy_scalar},
+#ifdef UGRAD_SIMD_X86
+      {SimdIsa::SSE2, dot_scalar, axpy_scalar},
+      {SimdIsa::AVX2, dot_avx2, axpy_avx2},
+      {SimdIsa::AVX512, dot_avx512, axpy_avx512},
+#endif
+  };
+  for (auto& kernel : kernels) {
+    if (kernel.isa == isa) {
+      return kernel;
+    }
+  }
+  return kernels[0];
+}
+
+inline std::atomic<const VectorKernels*>& vector_kernels_slot() {
+  static std::atomic<const VectorKernels*> kernels{
+      &vector_kernels(best_simd_isa())};
+  return kernels;
+}
+
+inline SimdIsa vector_isa() { return vector_kernels_slot().load()->isa; }
+
+// forces the kernels of `isa`, e.g. to compare them; the CPU must support it
+inline void set_vector_isa(SimdIsa isa) {
+  assert(simd_supports(isa));
+  vector_kernels_slot() = &vector_kernels(isa);
+}
+
+// sum of x[i] * y[i]
+inline double vdot(size_t n, const double* x, const double* y) {
+  return vector_kernels_slot().load(std::memory_order_relaxed)->dot(n, x, y);
+}
+
+// y += alpha * x
+inline void axpy(size_t n, double alpha, const double* x, double* y) {
+  vector_kernels_slot().load(std::memory_order_relaxed)->axpy(n, alpha, x, y);
+}
+
+}  // namespace ugrad
+#endif  // __UGRAD_SIMD_HPP__
@@ -0,0 +1,342 @@
+#ifndef __UGRAD_TAPE_HPP__
+#define __UGRAD_TAPE_HPP__
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+namespace ugrad {
+
+// Arena-backed alternative to the shared_ptr engine. Every node of a step is
+// appended to one contiguous Wengert list and referred to by a 32-bit index,
+// so building the graph costs no allocation beyond the arena growing and
+// creation order doubles as the topological order for backward. The list is
+// truncated wholesale between training steps, leaves recorded before the
+// truncation point (parameters) survive it.
+namespace tape {
+
+using std::ostream;
+using std::vector;
+
+enum class Op : uint8_t { Leaf, Add, Sub, Mul, Div, Neg, Relu, Pow };
+
+struct Var;
+
+// Nodes are stored as a struct of arrays: data, grad, op code and operand
+// indices each live in their own contiguous array, so the reverse sweep
+// streams through them instead of striding over whole records.
+class Tape {
+ public:
+  // a new tape becomes the active one of its thread until it is destroyed
+  explicit Tape(size_t capacity = 0) : _prev{current()} {
+    reserve(capacity);
+    current() = this;
+  }
+  ~Tape() { current() = _prev; }
+  Tape(const Tape&) = delete;
+  Tape& operator=(const Tape&) = delete;
+
+  static Tape& active() {
+    assert(current() && "no ugrad::tape::Tape alive on this thread");
+    return *current();
+  }
+
+  Var var(double data);
+
+  uint32_t push(double data, Op op, uint32_t lhs = 0, uint32_t rhs = 0) {
+    if (_replaying) {
+      if (_cursor < size() && _op[_cursor] == op && _lhs[_cursor] == lhs &&
+          _rhs[_cursor] == rhs) {
+        _data[_cursor] = data;
+        _grad[_cursor] = 0.0;
+        return static_cast<uint32_t>(_cursor++);
+      }
+      // control flow took another path, record the rest of the step afresh
+      reset(_cursor);
+      _replaying = false;
+    }
+    assert(_data.size() < std::numeric_limits<uint32_t>::max());
+    _data.push_back(data);
+    _grad.push_back(0.0);
+    _op.push_back(op);
+    _lhs.push_back(lhs);
+    _rhs.push_back(rhs);
+    return static_cast<uint32_t>(_data.size() - 1);
+  }
+
+  double& data(uint32_t idx) { return _data[idx]; }
+  double& grad(uint32_t idx) { return _grad[idx]; }
+  Op op(uint32_t idx) const { return _op[idx]; }
+  uint32_t lhs(uint32_t idx) const { return _lhs[idx]; }
+  uint32_t rhs(uint32_t idx) const { return _rhs[idx]; }
+  size_t size() const { return _data.size(); }
+  size_t capacity() const { return _data.capacity(); }
+
+  void reserve(size_t capacity) {
+    _data.reserve(capacity);
+    _grad.reserve(capacity);
+    _op.reserve(capacity);
+    _lhs.reserve(capacity);
+    _rhs.reserve(capacity);
+  }
+
+  // everything recorded at or after `mark` is dropped, the storage is kept
+  void reset(size_t mark = 0) {
+    mark = std::min(mark, size());
+    _data.resize(mark);
+    _grad.resize(mark);
+    _op.resize(mark);
+    _lhs.resize(mark);
+    _rhs.resize(mark);
+  }
+
+  void zero_grad() { std::fill(_grad.begin(), _grad.end(), 0.0); }
+
+  // Guarded replay: the nodes pushed from now on are matched against the ones
+  // recorded at `mark` onwards and overwrite their data in place as long as
+  // op code and operands agree. The first mismatch truncates the tape there
+  // and recording continues normally.
+  void replay_from(size_t mark) {
+    _cursor = std::min(mark, size());
+    _replaying = true;
+  }
+
+  // ends a replay, true if the replayed step matched the recorded one exactly
+  bool finish_replay() {
+    auto matched = _replaying && _cursor == size();
+    if (_replaying) {
+      reset(_cursor);
+    }
+    _replaying = false;
+    return matched;
+  }
+
+  // recomputes the data of every node from `begin` on, leaves keep theirs
+  void forward(size_t begin = 0) {
+    for (auto i = begin; i < size(); ++i) {
+      if (_op[i] != Op::Leaf) {
+        _data[i] = eval(_op[i], _data[_lhs[i]], _data[_rhs[i]]);
+      }
+    }
+  }
+
+  static double eval(Op op, double lhs, double rhs) {
+    switch (op) {
+      case Op::Leaf: return lhs;
+      case Op::Add: return lhs + rhs;
+      case Op::Sub: return lhs - rhs;
+      case Op::Mul: return lhs * rhs;
+      case Op::Div: return lhs / rhs;
+      case Op::Neg: return -lhs;
+      case Op::Relu: return std::max(0.0, lhs);
+      case Op::Pow: return std::pow(lhs, rhs);
+    }
+    return 0.0;
+  }
+
+  // Walks the tape backwards in runs of equal op codes, so the dispatch is
+  // hoisted out of the inner loop and each run is a tight loop over the arrays.
+  void backward(uint32_t root) {
+    _grad[root] = 1.0;
+    auto end = size_t{root} + 1;
+    while (end > 0) {
+      auto op = _op[end - 1];
+      auto begin = end - 1;
+      while (begin > 0 && _op[begin - 1] == op) {
+        --begin;
+      }
+      switch (op) {
+        case Op::Leaf: break;
+        case Op::Add: sweep<Op::Add>(begin, end); break;
+        case Op::Sub: sweep<Op::Sub>(begin, end); break;
+        case Op::Mul: sweep<Op::Mul>(begin, end); break;
+        case Op::Div: sweep<Op::Div>(begin, end); break;
+        case Op::Neg: sweep<Op::Neg>(begin, end); break;
+        case Op::Relu: sweep<Op::Relu>(begin, end); break;
+        case Op::Pow: sweep<Op::Pow>(begin, end); break;
+      }
+      end = begin;
+    }
+  }
+
+ private:
+  static Tape*& current() {
+    static thread_local Tape* tape = nullptr;
+    return tape;
+  }
+
+  // local derivatives of node i with respect to its operands
+  template <Op op>
+  void partials(size_t i, double& dlhs, double& drhs) const {
+    const auto* __restrict data = _data.data();
+    auto g = _grad[i];
+    switch (op) {
+      case Op::Add: dlhs = g; drhs = g; break;
+      case Op::Sub: dlhs = g; drhs = -g; break;
+      case Op::Mul: dlhs = data[_rhs[i]] * g; drhs = data[_lhs[i]] * g; break;
+      case Op::Div:
+        dlhs = g / data[_rhs[i]];
+        drhs = -g * data[i] / data[_rhs[i]];
+        break;
+      case Op::Neg: dlhs = -g; break;
+      case Op::Relu: dlhs = (data[i] > 0) * g; break;
+      case Op::Pow: {
+        // like Value::pow, the exponent is treated as a constant
+        auto exp = data[_rhs[i]];
+        dlhs = exp * std::pow(data[_lhs[i]], exp - 1) * g;
+        break;
+      }
+      default: break;
+    }
+  }
+
+  template <Op op>
+  static constexpr bool is_unary() {
+    return op == Op::Neg || op == Op::Relu || op == Op::Pow;
+  }
+
+  template <Op op>
+  void sweep(size_t begin, size_t end) {
+    // A run whose operands all precede it is independent: no node of the run
+    // feeds another, so the partials can be computed for the whole run at
+    // once in a gather loop the compiler vectorizes, then scattered.
+    uint32_t max_operand = 0;
+    for (auto i = begin; i < end; ++i) {
+      max_operand = std::max(max_operand, std::max(_lhs[i], _rhs[i]));
+    }
+    if (end - begin >= kMinSimdRun && max_operand < begin) {
+      _dlhs.resize(end - begin);
+      _drhs.resize(end - begin);
+      for (auto i = begin; i < end; ++i) {
+        partials<op>(i, _dlhs[i - begin], _drhs[i - begin]);
+      }
+      for (auto i = begin; i < end; ++i) {
+        _grad[_lhs[i]] += _dlhs[i - begin];
+        if (!is_unary<op>()) {
+          _grad[_rhs[i]] += _drhs[i - begin];
+        }
+      }
+      return;
+    }
+    for (auto i = end; i-- > begin;) {
+      double dlhs = 0.0, drhs = 0.0;
+      partials<op>(i, dlhs, drhs);
+      _grad[_lhs[i]] += dlhs;
+      if (!is_unary<op>()) {
+        _grad[_rhs[i]] += drhs;
+      }
+    }
+  }
+
+  static constexpr size_t kMinSimdRun = 8;
+
+  vector<double> _data;
+  vector<double> _grad;
+  vector<Op> _op;
+  vector<uint32_t> _lhs;
+  vector<uint32_t> _rhs;
+  // scratch partials of independent runs
+  vector<double> _dlhs;
+  vector<double> _drhs;
+  size_t _cursor = 0;
+  bool _replaying = false;
+  Tape* _prev;
+};
+
+// 32-bit handle of a node on the active tape
+struct Var {
+  uint32_t idx;
+
+  double data() const { return Tape::active().data(idx); }
+  void set_data(double data) const { Tape::active().data(idx) = data; }
+  double grad() const { return Tape::active().grad(idx); }
+  void set_grad(double grad) const { Tape::active().grad(idx) = grad; }
+
+  Var relu() const {
+    auto& tape = Tape::active();
+    return {tape.push(std::max(0.0, tape.data(idx)), Op::Relu, idx)};
+  }
+
+  Var pow(Var rhs) const {
+    auto& tape = Tape::active();
+    auto data = std::pow(tape.data(idx), tape.data(rhs.idx));
+    return {tape.push(data, Op::Pow, idx, rhs.idx)};
+  }
+
+  Var pow(double exp) const { return pow(Tape::active().var(exp)); }
+
+  void backward() const { Tape::active().backward(idx); }
+
+  friend ostream& operator<<(ostream& os, const Var& var) {
+    os << "Var(data=" << var.data() << ", grad=" << var.grad() << ")";
+    return os;
+  }
+};
+
+inline Var Tape::var(double data) { return {push(data, Op::Leaf)}; }
+
+inline Var binary(Op op, Var lhs, Var rhs) {
+  auto& tape = Tape::active();
+  auto data = Tape::eval(op, tape.data(lhs.idx), tape.data(rhs.idx));
+  return {tape.push(data, op, lhs.idx, rhs.idx)};
+}
+
+inline Var operator+(Var lhs, Var rhs) { return binary(Op::Add, lhs, rhs); }
+inline Var operator-(Var lhs, Var rhs) { return binary(Op::Sub, lhs, rhs); }
+inline Var operator*(Var lhs, Var rhs) { return binary(Op::Mul, lhs, rhs); }
+inline Var operator/(Var lhs, Var rhs) { return binary(Op::Div, lhs, rhs); }
+
+inline Var operator-(Var rhs) {
+  auto& tape = Tape::active();
+  return {tape.push(-tape.data(rhs.idx), Op::Neg, rhs.idx)};
+}
+
+inline Var operator+(Var lhs, double val) { return lhs + Tape::active().var(val); }
+inline Var operator+(double val, Var rhs) { return Tape::active().var(val) + rhs; }
+inline Var operator-(Var lhs, double val) { return lhs - Tape::active().var(val); }
+inline Var operator-(double val, Var rhs) { return Tape::active().var(val) - rhs; }
+inline Var operator*(Var lhs, double val) { return lhs * Tape::active().var(val); }
+inline Var operator*(double val, Var rhs) { return Tape::active().var(val) * rhs; }
+inline Var operator/(Var lhs, double val) { return lhs / Tape::active().var(val); }
+inline Var operator/(double val, Var rhs) { return Tape::active().var(val) / rhs; }
+
+// Records one training step on the first run() and replays it on later ones:
+// the step function runs again, but its nodes land on the storage recorded
+// the first time instead of growing the tape, with the new input and
+// parameter values. A step that builds a differently shaped graph is
+// re-recorded from the point where it diverged.
+class Capture {
+ public:
+  explicit Capture(Tape& tape) : _tape{tape}, _mark{tape.size()} {}
+
+  template <typename Step>
+  Var run(Step&& step) {
+    auto replaying = _records > 0;
+    if (replaying) {
+      _tape.replay_from(_mark);
+    } else {
+      _tape.reset(_mark);
+    }
+    Var out = step();
+    if (!(replaying && _tape.finish_replay())) {
+      ++_records;
+    }
+    return out;
+  }
+
+  // how many times the step had to be recorded rather than replayed
+  size_t records() const { return _records; }
+
+ private:
+  Tape& _tape;
+  size_t _mark;
+  size_t _records = 0;
+};
+
+}  // namespace tape
+}  // namespace ugrad
+#endif  // __UGRAD_TAPE_HPP__
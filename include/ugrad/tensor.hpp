@@ -0,0 +1,105 @@
+#ifndef __UGRAD_TENSOR_HPP__
+#define __UGRAD_TENSOR_HPP__
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <ugrad/gemm.hpp>
+
+namespace ugrad {
+
+// Data and grad arrays shared by many tensors, 64-byte aligned and zeroed, so
+// that the parameters of a model form two contiguous arrays (see Module).
+class ParameterBuffer {
+ public:
+  explicit ParameterBuffer(size_t size)
+      : _size{size}, _data{allocate(size)}, _grad{allocate(size)} {}
+  ParameterBuffer(const ParameterBuffer&) = delete;
+  ParameterBuffer& operator=(const ParameterBuffer&) = delete;
+
+  size_t size() const { return _size; }
+  double* data() { return _data.get(); }
+  double* grad() { return _grad.get(); }
+
+ private:
+  struct Free {
+    void operator()(double* ptr) const { std::free(ptr); }
+  };
+
+  static double* allocate(size_t size) {
+    auto bytes = std::max<size_t>((size * sizeof(double) + 63) / 64 * 64, 64);
+    auto ptr = static_cast<double*>(std::aligned_alloc(64, bytes));
+    if (!ptr) {
+      throw std::bad_alloc();
+    }
+    std::memset(ptr, 0, bytes);
+    return ptr;
+  }
+
+  size_t _size;
+  std::unique_ptr<double, Free> _data;
+  std::unique_ptr<double, Free> _grad;
+};
+
+// Row-major matrix carried by a tensor node of the graph: a [batch x features]
+// activation, a weight matrix or a bias row. Data and grad are contiguous
+// arrays of rows * cols doubles, owned by the tensor or, once bound, a range
+// of a ParameterBuffer.
+struct Tensor {
+  Tensor(size_t rows, size_t cols)
+      : _rows{rows}, _cols{cols}, _data(rows * cols), _grad(rows * cols) {
+    _data_ptr = _data.data();
+    _grad_ptr = _grad.data();
+  }
+  Tensor(size_t rows, size_t cols, std::vector<double> data)
+      : _rows{rows}, _cols{cols}, _data{std::move(data)}, _grad(rows * cols) {
+    assert(_data.size() == rows * cols);
+    _data_ptr = _data.data();
+    _grad_ptr = _grad.data();
+  }
+
+  size_t rows() const { return _rows; }
+  size_t cols() const { return _cols; }
+  size_t size() const { return _rows * _cols; }
+  double* data() { return _data_ptr; }
+  const double* data() const { return _data_ptr; }
+  double* grad() { return _grad_ptr; }
+  const double* grad() const { return _grad_ptr; }
+  double& at(size_t row, size_t col) { return _data_ptr[row * _cols + col]; }
+  void zero_grad() { std::fill(_grad_ptr, _grad_ptr + size(), 0.0); }
+
+  // Moves data and grad to `buffer` from `offset` on, the tensor views that
+  // range from then on and keeps the buffer alive.
+  void bind(std::shared_ptr<ParameterBuffer> buffer, size_t offset) {
+    assert(offset + size() <= buffer->size());
+    std::copy(data(), data() + size(), buffer->data() + offset);
+    std::copy(grad(), grad() + size(), buffer->grad() + offset);
+    _data_ptr = buffer->data() + offset;
+    _grad_ptr = buffer->grad() + offset;
+    _storage = std::move(buffer);
+    _data = {};
+    _grad = {};
+  }
+
+  size_t _rows;
+  size_t _cols;
+  // owned storage, empty once bound to a buffer
+  std::vector<double> _data;
+  std::vector<double> _grad;
+  std::shared_ptr<ParameterBuffer> _storage;
+  double* _data_ptr;
+  double* _grad_ptr;
+  // serializes grad accumulation from concurrent backward steps
+  std::mutex _grad_mutex;
+};
+
+}  // namespace ugrad
+#endif  // __UGRAD_TENSOR_HPP__
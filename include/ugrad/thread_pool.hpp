@@ -0,0 +1,307 @@
+#ifndef __UGRAD_THREAD_POOL_HPP__
+#define __UGRAD_THREAD_POOL_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ugrad {
+
+// Work-stealing thread pool. Every worker owns a deque: tasks submitted from
+// a worker go onto its own deque and are popped back LIFO, which keeps a
+// fork-join computation depth-first and cache-warm, while idle workers steal
+// the oldest tasks from the front of the other deques. Tasks submitted from
+// outside the pool land on a shared injection deque.
+//
+// A pool of `threads` runs threads - 1 workers: the thread waiting on a
+// TaskGroup runs tasks itself until the group is done, so a pool of one
+// thread executes everything inline on the caller.
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+      : _queues(std::max<size_t>(threads, 1)) {
+    for (size_t i = 0; i + 1 < _queues.size(); ++i) {
+      _threads.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock{_sleep};
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // threads that run tasks, counting the one that waits
+  size_t size() const { return _queues.size(); }
+
+  // tasks submitted and not yet taken by any thread
+  size_t pending() const { return _queued.load(std::memory_order_relaxed); }
+
+  void submit(Task task) {
+    auto& queue = _queues[local_queue()];
+    {
+      std::lock_guard<std::mutex> lock{queue._mutex};
+      queue._tasks.push_back(std::move(task));
+      _queued.fetch_add(1, std::memory_order_release);
+    }
+    {
+      std::lock_guard<std::mutex> lock{_sleep};
+    }
+    _wake.notify_one();
+  }
+
+  // runs one pending task on the calling thread, false if there was none
+  bool run_pending() {
+    Task task;
+    if (!take(local_queue(), task)) {
+      return false;
+    }
+    task();
+    return true;
+  }
+
+  // index of the calling worker in its pool, size() - 1 outside of any pool
+  static size_t worker_index(const ThreadPool& pool) {
+    return current()._pool == &pool ? current()._index : pool.size() - 1;
+  }
+
+ private:
+  struct Queue {
+    std::mutex _mutex;
+    std::deque<Task> _tasks;
+  };
+
+  struct Worker {
+    const ThreadPool* _pool = nullptr;
+    size_t _index = 0;
+  };
+
+  static Worker& current() {
+    static thread_local Worker worker;
+    return worker;
+  }
+
+  // the calling worker's deque, or the injection deque for other threads
+  size_t local_queue() const { return worker_index(*this); }
+
+  // own deque from the back first, then the others from the front
+  bool take(size_t own, Task& task) {
+    if (_queued.load(std::memory_order_acquire) == 0) {
+      return false;
+    }
+    for (size_t k = 0; k < _queues.size(); ++k) {
+      auto i = (own + k) % _queues.size();
+      auto& queue = _queues[i];
+      std::lock_guard<std::mutex> lock{queue._mutex};
+      if (queue._tasks.empty()) {
+        continue;
+      }
+      if (k == 0) {
+        task = std::move(queue._tasks.back());
+        queue._tasks.pop_back();
+      } else {
+        task = std::move(queue._tasks.front());
+        queue._tasks.pop_front();
+      }
+      _queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  void work(size_t index) {
+    current() = {this, index};
+    Task task;
+    while (true) {
+      if (take(index, task)) {
+        task();
+        task = nullptr;
+        continue;
+      }
+      std::unique_lock<std::mutex> lock{_sleep};
+      _wake.wait(lock, [this] {
+        return _stop || _queued.load(std::memory_order_acquire) > 0;
+      });
+      if (_stop) {
+        return;
+      }
+    }
+  }
+
+  std::vector<Queue> _queues;
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _queued{0};
+  std::mutex _sleep;
+  std::condition_variable _wake;
+  bool _stop = false;
+};
+
+// Fork-join scope on a pool: run() submits tasks, wait() returns once all of
+// them finished, executing pending tasks of the pool in the meantime.
+class TaskGroup {
+ public:
+  explicit TaskGroup(ThreadPool& pool) : _pool{pool} {}
+  ~TaskGroup() { wait(); }
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  template <typename F>
+  void run(F&& task) {
+    _pending.fetch_add(1, std::memory_order_relaxed);
+    _pool.submit([this, task = std::forward<F>(task)]() mutable {
+      task();
+      _pending.fetch_sub(1, std::memory_order_acq_rel);
+    });
+  }
+
+  void wait() {
+    while (_pending.load(std::memory_order_acquire) > 0) {
+      if (!_pool.run_pending()) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  ThreadPool& pool() { return _pool; }
+
+ private:
+  ThreadPool& _pool;
+  std::atomic<size_t> _pending{0};
+};
+
+// Calls body(i) for every i in [begin, end) on the threads of `pool`. The
+// range is split lazily: the calling thread works through it `grain` indices
+// at a time and, whenever the pool has no task queued (some thread may be
+// idle), hands the upper half of what is left to the pool first. Balanced
+// loops thus end up in a few chunks per thread, uneven ones keep splitting
+// where threads run dry, and a pool of one thread runs the loop inline.
+template <typename Body>
+void parallel_for(ThreadPool& pool, size_t begin, size_t end, Body&& body,
+                  size_t grain = 1) {
+  grain = std::max<size_t>(grain, 1);
+  if (pool.size() == 1 || end - begin <= grain) {
+    for (auto i = begin; i < end; ++i) {
+      body(i);
+    }
+    return;
+  }
+  TaskGroup group{pool};
+  while (begin < end) {
+    if (end - begin > grain && pool.pending() == 0) {
+      auto mid = begin + (end - begin) / 2;
+      group.run([&pool, &body, mid, end, grain] {
+        parallel_for(pool, mid, end, body, grain);
+      });
+      end = mid;
+      continue;
+    }
+    auto stop = std::min(end, begin + grain);
+    for (auto i = begin; i < stop; ++i) {
+      body(i);
+    }
+    begin = stop;
+  }
+  group.wait();
+}
+
+// Runs the callables concurrently on `pool`, the first one on the calling
+// thread, and returns when all of them are done.
+template <typename First, typename... Rest>
+void parallel_invoke(ThreadPool& pool, First&& first, Rest&&... rest) {
+  TaskGroup group{pool};
+  (group.run(std::forward<Rest>(rest)), ...);
+  first();
+  group.wait();
+}
+
+// The pool shared by the library, created on first use with
+// UGRAD_NUM_THREADS threads, or one per hardware thread when unset. Sharing
+// it keeps nested parallel code from oversubscribing the cores. Read and
+// replaced with the atomic shared_ptr functions only.
+inline std::shared_ptr<ThreadPool>& default_pool_owner() {
+  static std::shared_ptr<ThreadPool> pool;
+  return pool;
+}
+
+inline std::mutex& default_pool_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// the pool of the innermost PoolScope on this thread, if any
+inline ThreadPool*& scoped_pool() {
+  static thread_local ThreadPool* pool = nullptr;
+  return pool;
+}
+
+// The pool to run on: the scoped one, else the default pool. Callers hold
+// the pointer while they use the pool, which keeps a pool replaced by
+// set_num_threads() alive until the last of them is done with it.
+inline std::shared_ptr<ThreadPool> default_pool() {
+  if (auto scoped = scoped_pool()) {
+    // not owned, the PoolScope outlives every use on its thread
+    return std::shared_ptr<ThreadPool>{std::shared_ptr<ThreadPool>{}, scoped};
+  }
+  auto& owner = default_pool_owner();
+  if (auto pool = std::atomic_load(&owner)) {
+    return pool;
+  }
+  std::lock_guard<std::mutex> lock{default_pool_mutex()};
+  if (!owner) {
+    auto env = std::getenv("UGRAD_NUM_THREADS");
+    auto threads = env ? std::strtoull(env, nullptr, 10) : 0;
+    std::atomic_store(&owner, threads ? std::make_shared<ThreadPool>(threads)
+                                      : std::make_shared<ThreadPool>());
+  }
+  return owner;
+}
+
+// Replaces the default pool by one of `threads` threads. Work in flight
+// finishes on the old pool, which goes away with its last user.
+inline void set_num_threads(size_t threads) {
+  std::lock_guard<std::mutex> lock{default_pool_mutex()};
+  std::atomic_store(&default_pool_owner(),
+                    std::make_shared<ThreadPool>(threads));
+}
+
+inline size_t num_threads() { return default_pool()->size(); }
+
+// Makes default_pool() return `pool` on the calling thread while alive. A
+// thread that is already one of several parallel workers, e.g. a replica of
+// DataParallelTrainer, scopes a pool of one thread to run the library's
+// kernels inline instead of oversubscribing the shared pool.
+class PoolScope {
+ public:
+  explicit PoolScope(ThreadPool& pool) : _prev{scoped_pool()} {
+    scoped_pool() = &pool;
+  }
+  ~PoolScope() { scoped_pool() = _prev; }
+  PoolScope(const PoolScope&) = delete;
+  PoolScope& operator=(const PoolScope&) = delete;
+
+ private:
+  ThreadPool* _prev;
+};
+
+}  // namespace ugrad
+#endif  // __UGRAD_THREAD_POOL_HPP__
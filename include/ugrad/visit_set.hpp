@@ -0,0 +1,143 @@
+#ifndef __UGRAD_VISIT_SET_HPP__
+#define __UGRAD_VISIT_SET_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ugrad {
+
+// Visited marks of one graph traversal: an open-addressing set of node
+// addresses with linear probing. Traversals own their set instead of marking
+// the nodes, so graphs that share nodes can be walked by several threads at
+// once.
+class VisitSet {
+ public:
+  explicit VisitSet(size_t expected = 0) { rehash(expected * 2); }
+
+  // true if `node` was not in the set yet
+  bool insert(const void* node) {
+    if ((_size + 1) * 2 > _slots.size()) {
+      rehash(_slots.size() * 2);
+    }
+    auto mask = _slots.size() - 1;
+    for (auto i = hash(node) & mask;; i = (i + 1) & mask) {
+      if (_slots[i] == node) {
+        return false;
+      }
+      if (!_slots[i]) {
+        _slots[i] = node;
+        ++_size;
+        return true;
+      }
+    }
+  }
+
+  bool contains(const void* node) const {
+    auto mask = _slots.size() - 1;
+    for (auto i = hash(node) & mask; _slots[i]; i = (i + 1) & mask) {
+      if (_slots[i] == node) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t size() const { return _size; }
+
+  // nodes are 16-byte aligned, mix the high bits into the low ones
+  static size_t hash(const void* node) {
+    auto x = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(node));
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return static_cast<size_t>(x);
+  }
+
+ private:
+  static constexpr size_t kMinSlots = 16;
+
+  void rehash(size_t slots) {
+    auto capacity = kMinSlots;
+    while (capacity < slots) {
+      capacity *= 2;
+    }
+    std::vector<const void*> old(capacity, nullptr);
+    old.swap(_slots);
+    _size = 0;
+    for (auto node : old) {
+      if (node) {
+        insert(node);
+      }
+    }
+  }
+
+  std::vector<const void*> _slots;
+  size_t _size = 0;
+};
+
+// Dense numbering of the nodes of one traversal: maps a node address to the
+// position it was inserted at, so per-node state of the traversal can live in
+// plain arrays. Same probing scheme as VisitSet.
+class NodeIndex {
+ public:
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  explicit NodeIndex(size_t expected = 0) { rehash(expected * 2); }
+
+  // index of `node`, which gets the next free one if it is new
+  uint32_t insert(const void* node) {
+    if ((_nodes.size() + 1) * 2 > _slots.size()) {
+      rehash(_slots.size() * 2);
+    }
+    auto mask = _slots.size() - 1;
+    for (auto i = VisitSet::hash(node) & mask;; i = (i + 1) & mask) {
+      if (_slots[i] == npos) {
+        _slots[i] = static_cast<uint32_t>(_nodes.size());
+        _nodes.push_back(node);
+        return _slots[i];
+      }
+      if (_nodes[_slots[i]] == node) {
+        return _slots[i];
+      }
+    }
+  }
+
+  // index of `node`, npos if it was never inserted
+  uint32_t find(const void* node) const {
+    auto mask = _slots.size() - 1;
+    for (auto i = VisitSet::hash(node) & mask; _slots[i] != npos;
+         i = (i + 1) & mask) {
+      if (_nodes[_slots[i]] == node) {
+        return _slots[i];
+      }
+    }
+    return npos;
+  }
+
+  size_t size() const { return _nodes.size(); }
+
+ private:
+  void rehash(size_t slots) {
+    auto capacity = size_t{16};
+    while (capacity < slots) {
+      capacity *= 2;
+    }
+    _slots.assign(capacity, npos);
+    auto mask = capacity - 1;
+    for (size_t n = 0; n < _nodes.size(); ++n) {
+      auto i = VisitSet::hash(_nodes[n]) & mask;
+      while (_slots[i] != npos) {
+        i = (i + 1) & mask;
+      }
+      _slots[i] = static_cast<uint32_t>(n);
+    }
+  }
+
+  // indices into _nodes, npos marks a free slot
+  std::vector<uint32_t> _slots;
+  std::vector<const void*> _nodes;
+};
+
+}  // namespace ugrad
+#endif  // __UGRAD_VISIT_SET_HPP__
@@ -3,10 +3,13 @@
 #include <pybind11/stl.h>
 #include <pybind11/functional.h>
 
+#include <optional>
 #include <sstream>
 
 #include <ugrad/engine.hpp>
+#include <ugrad/loss.hpp>
 #include <ugrad/nn.hpp>
+#include <ugrad/optim.hpp>
 
 namespace py = pybind11;
 using ugrad::Value;
@@ -15,22 +18,69 @@ using ugrad::Module;
 using ugrad::Neuron;
 using ugrad::Layer;
 using ugrad::MLP;
+using ugrad::NoGradGuard;
+namespace optim = ugrad::optim;
+
+// the tensor of a node, a Python ValueError for a scalar node
+static const ugrad::Tensor& tensor_of(const Value& val) {
+  if (!val.is_tensor()) {
+    throw py::value_error("not a tensor node");
+  }
+  return val.tensor();
+}
+
+// the data or grad of a tensor node as a list of rows
+static std::vector<std::vector<double>> tensor_rows(const Value& val,
+                                                    bool grad) {
+  auto& tensor = tensor_of(val);
+  auto values = grad ? tensor.grad() : tensor.data();
+  std::vector<std::vector<double>> rows;
+  for (size_t i = 0; i < tensor.rows(); ++i) {
+    rows.emplace_back(values + i * tensor.cols(),
+                      values + (i + 1) * tensor.cols());
+  }
+  return rows;
+}
+
+// the tensor leaves of a module's parameter view as a Python list
+static std::vector<ValuePtr> parameter_list(const Module& module) {
+  auto params = module.parameters();
+  return {params.begin(), params.end()};
+}
 
 PYBIND11_MODULE(pyugrad, m) {
   py::class_<Value, std::shared_ptr<Value>>(m, "Value")
-      .def(py::init<double>())
+      .def(py::init<double, bool>(), py::arg("data"),
+           py::arg("requires_grad") = true)
       .def(py::init<int>())
       .def_property("data", &Value::data, &Value::set_data)
       .def_property("grad", &Value::grad, &Value::set_grad)
-      .def("backward", &Value::backward)
+      .def_property(
+          "requires_grad", [](const Value& val) { return val.requires_grad(); },
+          [](Value& val, bool status) { val.requires_grad(status); })
+      .def_property_readonly("is_tensor", &Value::is_tensor)
+      .def_property_readonly("shape", [](const Value& val) {
+        auto& tensor = tensor_of(val);
+        return std::make_pair(tensor.rows(), tensor.cols());
+      })
+      .def("tolist", [](const Value& val) { return tensor_rows(val, false); })
+      .def("grad_tolist",
+           [](const Value& val) { return tensor_rows(val, true); })
+      .def("backward", py::overload_cast<>(&Value::backward))
       .def("relu", &Value::relu)
+      .def("exp", &Value::exp)
+      .def("log", &Value::log)
+      .def("tanh", &Value::tanh)
+      .def("sigmoid", &Value::sigmoid)
       .def("__neg__", [](ValuePtr lhs) { return -lhs; })
       .def("__add__", [](ValuePtr lhs, ValuePtr rhs) { return lhs + rhs; })
       .def("__add__", [](ValuePtr lhs, double rhs) { return lhs + rhs; })
       .def("__radd__", [](ValuePtr lhs, ValuePtr rhs) { return lhs + rhs; })
       .def("__radd__", [](ValuePtr lhs, double rhs) { return lhs + rhs; })
       .def("__sub__", [](ValuePtr lhs, ValuePtr rhs) { return lhs - rhs; })
+      .def("__sub__", [](ValuePtr lhs, double rhs) { return lhs - rhs; })
       .def("__rsub__", [](ValuePtr lhs, ValuePtr rhs) { return rhs - lhs; })
+      .def("__rsub__", [](ValuePtr lhs, double rhs) { return rhs - lhs; })
       .def("__mul__", [](ValuePtr lhs, ValuePtr rhs) { return lhs * rhs; })
       .def("__mul__", [](ValuePtr lhs, double rhs) { return lhs * rhs; })
       .def("__rmul__", [](ValuePtr lhs, ValuePtr rhs) { return lhs * rhs; })
@@ -47,15 +97,77 @@ PYBIND11_MODULE(pyugrad, m) {
         return ss.str();
       });
 
+  // `with pyugrad.no_grad():` holds a NoGradGuard for the block
+  struct PyNoGrad {
+    std::optional<NoGradGuard> guard;
+  };
+  py::class_<PyNoGrad>(m, "no_grad")
+      .def(py::init<>())
+      .def("__enter__", [](PyNoGrad& self) { self.guard.emplace(); })
+      .def("__exit__", [](PyNoGrad& self, py::args) { self.guard.reset(); });
+  m.def("is_grad_enabled", &ugrad::GradMode::is_enabled);
+
+  // threads of the pool shared by Layer and the parallel backward
+  m.def("set_num_threads", &ugrad::set_num_threads, py::arg("threads"));
+  m.def("get_num_threads", &ugrad::num_threads);
+
+  m.def("sum", py::overload_cast<const std::vector<ValuePtr>&>(&ugrad::sum));
+  m.def("sum", py::overload_cast<const ValuePtr&>(&ugrad::sum));
+  m.def("dot", &ugrad::dot);
+
+  // a [rows x cols] tensor node from a list of equally long rows
+  m.def(
+      "tensor",
+      [](const std::vector<std::vector<double>>& rows, bool requires_grad) {
+        auto cols = rows.empty() ? 0 : rows[0].size();
+        std::vector<double> data;
+        data.reserve(rows.size() * cols);
+        for (auto& row : rows) {
+          if (row.size() != cols) {
+            throw py::value_error("tensor rows differ in length");
+          }
+          data.insert(data.end(), row.begin(), row.end());
+        }
+        return ugrad::make_tensor(rows.size(), cols, std::move(data),
+                                  requires_grad);
+      },
+      py::arg("rows"), py::arg("requires_grad") = true);
+
   py::class_<Module>(m, "Module")
     .def(py::init<>())
     .def("zero_grad", &Module::zero_grad)
-    .def("parameters", &Module::parameters);
+    .def("parameters", &parameter_list);
+
+  m.def(
+      "l2_penalty",
+      [](const Module& module, double coefficient) {
+        return ugrad::l2_penalty(module.parameters(), coefficient);
+      },
+      py::arg("module"), py::arg("coefficient") = 1.0);
+
+  // losses return (loss, accuracy)
+  auto loss_module = m.def_submodule("loss");
+  using LossFn = ugrad::loss::Result (*)(const ValuePtr&, const ValuePtr&);
+  auto def_loss = [&](const char* name, LossFn fn) {
+    loss_module.def(
+        name,
+        [fn](const ValuePtr& scores, const ValuePtr& targets) {
+          auto result = fn(scores, targets);
+          return std::make_tuple(result.loss, result.accuracy);
+        },
+        py::arg("scores"), py::arg("targets"));
+  };
+  def_loss("hinge", &ugrad::loss::hinge);
+  def_loss("mse", &ugrad::loss::mse);
+  def_loss("logistic", &ugrad::loss::logistic);
+  def_loss("softmax_cross_entropy", &ugrad::loss::softmax_cross_entropy);
 
   py::class_<Neuron, Module>(m, "Neuron")
     .def(py::init<size_t>())
-    .def("__call__", &Neuron::operator())
-    .def_property_readonly("parameters", &Neuron::parameters)
+    .def("__call__",
+         py::overload_cast<const std::vector<ValuePtr>&>(&Neuron::operator()))
+    .def("__call__", py::overload_cast<const ValuePtr&>(&Neuron::operator()))
+    .def_property_readonly("parameters", &parameter_list)
     .def("__repr__", [](const Neuron& neuron) {
         std::stringstream ss;
         ss << neuron;
@@ -64,8 +176,10 @@ PYBIND11_MODULE(pyugrad, m) {
 
   py::class_<Layer, Module>(m, "Layer")
     .def(py::init<size_t, size_t>())
-    .def("__call__", &Layer::operator())
-    .def_property_readonly("parameters", &Layer::parameters)
+    .def("__call__",
+         py::overload_cast<std::vector<ValuePtr>>(&Layer::operator()))
+    .def("__call__", py::overload_cast<const ValuePtr&>(&Layer::operator()))
+    .def_property_readonly("parameters", &parameter_list)
     .def("__repr__", [](const Layer& layer) {
         std::stringstream ss;
         ss << layer;
@@ -74,11 +188,64 @@ PYBIND11_MODULE(pyugrad, m) {
 
   py::class_<MLP, Module>(m, "MLP")
     .def(py::init<size_t, std::vector<size_t>>())
-    .def("__call__", &MLP::operator())
-    .def("parameters", &MLP::parameters)
+    .def("__call__", py::overload_cast<std::vector<ValuePtr>>(&MLP::operator()))
+    .def("__call__", py::overload_cast<ValuePtr>(&MLP::operator()))
+    .def("parameters", &parameter_list)
     .def("__repr__", [](const MLP& mlp) {
         std::stringstream ss;
         ss << mlp;
         return ss.str();
     });
+
+  // optimizers hold a view of the module's parameters and keep it alive
+  auto optim_module = m.def_submodule("optim");
+  py::class_<optim::Optimizer>(optim_module, "Optimizer")
+    .def("step", &optim::Optimizer::step)
+    .def("zero_grad", &optim::Optimizer::zero_grad)
+    .def_property("lr", &optim::Optimizer::lr, &optim::Optimizer::set_lr)
+    .def_property_readonly("weight_decay", &optim::Optimizer::weight_decay)
+    .def_property_readonly("decoupled", &optim::Optimizer::decoupled)
+    .def_property_readonly("steps", &optim::Optimizer::steps);
+
+  py::class_<optim::SGD, optim::Optimizer>(optim_module, "SGD")
+    .def(py::init([](const Module& module, double lr, double momentum,
+                     bool nesterov, double weight_decay, bool decoupled) {
+           return new optim::SGD{module.parameters(), lr, momentum, nesterov,
+                                 weight_decay, decoupled};
+         }),
+         py::arg("module"), py::arg("lr"), py::arg("momentum") = 0.0,
+         py::arg("nesterov") = false, py::arg("weight_decay") = 0.0,
+         py::arg("decoupled") = false, py::keep_alive<1, 2>());
+
+  py::class_<optim::Adam, optim::Optimizer>(optim_module, "Adam")
+    .def(py::init([](const Module& module, double lr, double beta1,
+                     double beta2, double eps, double weight_decay,
+                     bool decoupled) {
+           return new optim::Adam{module.parameters(), lr, beta1, beta2, eps,
+                                  weight_decay, decoupled};
+         }),
+         py::arg("module"), py::arg("lr") = 1e-3, py::arg("beta1") = 0.9,
+         py::arg("beta2") = 0.999, py::arg("eps") = 1e-8,
+         py::arg("weight_decay") = 0.0, py::arg("decoupled") = false,
+         py::keep_alive<1, 2>());
+
+  py::class_<optim::AdamW, optim::Adam>(optim_module, "AdamW")
+    .def(py::init([](const Module& module, double lr, double beta1,
+                     double beta2, double eps, double weight_decay) {
+           return new optim::AdamW{module.parameters(), lr, beta1, beta2, eps,
+                                   weight_decay};
+         }),
+         py::arg("module"), py::arg("lr") = 1e-3, py::arg("beta1") = 0.9,
+         py::arg("beta2") = 0.999, py::arg("eps") = 1e-8,
+         py::arg("weight_decay") = 1e-2, py::keep_alive<1, 2>());
+
+  py::class_<optim::RMSProp, optim::Optimizer>(optim_module, "RMSProp")
+    .def(py::init([](const Module& module, double lr, double alpha,
+                     double eps, double weight_decay, bool decoupled) {
+           return new optim::RMSProp{module.parameters(), lr, alpha, eps,
+                                     weight_decay, decoupled};
+         }),
+         py::arg("module"), py::arg("lr") = 1e-2, py::arg("alpha") = 0.99,
+         py::arg("eps") = 1e-8, py::arg("weight_decay") = 0.0,
+         py::arg("decoupled") = false, py::keep_alive<1, 2>());
 }
@@ -1,5 +1,8 @@
 import torch
-from pyugrad import Value
+from pyugrad import Value, no_grad, is_grad_enabled
+from pyugrad import Layer, MLP, set_num_threads, get_num_threads
+from pyugrad import tensor, sum as ugrad_sum
+from pyugrad import optim, l2_penalty, loss
 
 def test_sanity_check():
 
@@ -65,3 +68,104 @@ def test_more_ops():
     # backward pass went well
     assert abs(amg.grad - apt.grad.item()) < tol
     assert abs(bmg.grad - bpt.grad.item()) < tol
+
+def test_no_grad():
+
+    a = Value(-4.0)
+    b = Value(2.0)
+    with no_grad():
+        assert not is_grad_enabled()
+        c = (a * b + 1).relu() + a * b
+    assert is_grad_enabled()
+    assert c.data == -8.0
+    assert not c.requires_grad
+    c.backward()
+    assert a.grad == 0.0
+
+def test_num_threads():
+
+    threads = get_num_threads()
+    x = [Value(0.01 * i) for i in range(64)]
+    layer = Layer(64, 256)
+    set_num_threads(1)
+    serial = [y.data for y in layer(x)]
+    set_num_threads(4)
+    assert get_num_threads() == 4
+    assert [y.data for y in layer(x)] == serial
+    set_num_threads(threads)
+
+def test_batch():
+
+    model = MLP(2, [8, 1])
+    rows = [[0.5 * i, 1.0 - 0.25 * i] for i in range(6)]
+    x = tensor(rows, requires_grad=False)
+    assert x.is_tensor
+    out = model(x)
+    assert out.shape == (6, 1)
+    for row, y in zip(rows, out.tolist()):
+        sample = model([Value(v) for v in row])
+        assert abs(sample[0].data - y[0]) < 1e-12
+    ugrad_sum(out).backward()
+    w = model.parameters()[0]
+    assert w.shape == (1, 3)
+    assert len(w.grad_tolist()[0]) == 3
+
+def test_scalar_not_tensor():
+
+    a = Value(1.0)
+    assert not a.is_tensor
+    for read in (lambda: a.shape, a.tolist, a.grad_tolist):
+        try:
+            read()
+            assert False, "expected a ValueError"
+        except ValueError:
+            pass
+
+def test_optim():
+
+    model = MLP(2, [4, 1])
+    x = tensor([[1.0, -2.0], [0.5, 3.0]], requires_grad=False)
+    ugrad_sum(model(x)).backward()
+    before = [(p.tolist(), p.grad_tolist()) for p in model.parameters()]
+    sgd = optim.SGD(model, lr=0.1)
+    sgd.step()
+    assert sgd.steps == 1
+    for p, (data, grad) in zip(model.parameters(), before):
+        for row, data_row, grad_row in zip(p.tolist(), data, grad):
+            for v, d, g in zip(row, data_row, grad_row):
+                assert abs(v - (d - 0.1 * g)) < 1e-12
+    sgd.zero_grad()
+    assert all(g == 0.0 for p in model.parameters()
+               for row in p.grad_tolist() for g in row)
+
+    adam = optim.AdamW(model, lr=1e-2)
+    adam.lr = 5e-3
+    assert adam.lr == 5e-3
+    assert adam.decoupled
+    assert not optim.SGD(model, lr=0.1, weight_decay=1e-2).decoupled
+
+def test_l2_penalty():
+
+    model = MLP(2, [4, 1])
+    penalty = l2_penalty(model, 0.5)
+    params = [v for p in model.parameters() for row in p.tolist() for v in row]
+    assert abs(penalty.data - 0.5 * sum(v * v for v in params)) < 1e-12
+    penalty.backward()
+    grads = [g for p in model.parameters()
+             for row in p.grad_tolist() for g in row]
+    assert all(abs(v - g) < 1e-12 for v, g in zip(params, grads))
+
+def test_loss():
+
+    scores = tensor([[2.0], [0.5], [-0.5], [-3.0]])
+    targets = tensor([[1.0], [1.0], [1.0], [-1.0]], requires_grad=False)
+    hinge, accuracy = loss.hinge(scores, targets)
+    assert abs(hinge.data - 0.5) < 1e-12
+    assert accuracy == 0.75
+    hinge.backward()
+    assert scores.grad_tolist() == [[0.0], [-0.25], [-0.25], [0.0]]
+
+    logits = tensor([[1000.0, 1001.0, 1002.0]])
+    labels = tensor([[2.0]], requires_grad=False)
+    ce, accuracy = loss.softmax_cross_entropy(logits, labels)
+    assert ce.data < 0.5 and accuracy == 1.0
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <ugrad/data_parallel.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::DataParallelTrainer;
+using ugrad::LayerKind;
+using ugrad::MLP;
+using ugrad::ParameterView;
+using ugrad::Tensor;
+namespace optim = ugrad::optim;
+
+// every length around the number of ranks and a bucket, on 1 to 4 ranks
+TEST(RingTest, AllReduce) {
+  for (size_t ranks = 1; ranks <= 4; ++ranks) {
+    for (size_t n : {0, 1, 3, 7, 16, 45}) {
+      vector<vector<double>> data(ranks, vector<double>(n));
+      vector<double*> buffers;
+      vector<double> expected(n);
+      for (size_t r = 0; r < ranks; ++r) {
+        for (size_t i = 0; i < n; ++i) {
+          data[r][i] = static_cast<double>((r + 1) * 100 + i);
+          expected[i] += data[r][i];
+        }
+        buffers.push_back(data[r].data());
+      }
+      ugrad::SpinBarrier barrier{ranks};
+      vector<std::thread> threads;
+      for (size_t r = 0; r < ranks; ++r) {
+        threads.emplace_back([&, r] {
+          ugrad::ring_all_reduce(buffers.data(), n, r, ranks, barrier, 16);
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      for (size_t r = 0; r < ranks; ++r) {
+        EXPECT_EQ(expected, data[r]) << ranks << " ranks, n " << n;
+      }
+    }
+  }
+}
+
+static std::unique_ptr<optim::Optimizer> make_sgd(ParameterView params) {
+  return std::make_unique<optim::SGD>(params, 0.1, 0.9);
+}
+
+// the steps of three workers against the same steps on one model
+TEST(DataParallelTest, MatchesSerial) {
+  const size_t rows = 50;
+  std::mt19937 rng{3};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  vector<double> x(rows * 2), y(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    x[2 * i] = dist(rng);
+    x[2 * i + 1] = dist(rng);
+    y[i] = x[2 * i] * x[2 * i + 1] > 0 ? 1.0 : -1.0;
+  }
+  Tensor xt{rows, 2, x}, yt{rows, 1, y};
+
+  DataParallelTrainer trainer{3, 2, {8, 1}, LayerKind::Linear, make_sgd};
+  ASSERT_EQ(3, trainer.workers());
+  MLP model{2, {8, 1}, LayerKind::Linear};
+  auto params = model.parameters();
+  auto first = trainer.model().parameters();
+  std::copy(first.data(), first.data() + first.numel(), params.data());
+  auto sgd = make_sgd(params);
+
+  for (size_t begin = 0; begin < rows; begin += 20) {
+    auto end = std::min(rows, begin + 20);
+    auto stats = trainer.step(xt, yt, begin, end);
+
+    vector<double> x_rows(x.begin() + 2 * begin, x.begin() + 2 * end);
+    auto xs = ugrad::make_tensor(end - begin, 2, std::move(x_rows), false);
+    auto ys = ugrad::make_tensor(
+        end - begin, 1, vector<double>(y.begin() + begin, y.begin() + end),
+        false);
+    sgd->zero_grad();
+    auto [loss, accuracy] = ugrad::loss::hinge(model(xs), ys);
+    loss->backward();
+    sgd->step();
+    EXPECT_NEAR(loss->data(), stats.loss, 1e-12);
+    EXPECT_NEAR(accuracy, stats.accuracy, 1e-12);
+  }
+  for (size_t rank = 0; rank < trainer.workers(); ++rank) {
+    auto replica = trainer.model(rank).parameters();
+    for (size_t i = 0; i < params.numel(); ++i) {
+      // replicas stay identical, and match up to the order of the sums
+      EXPECT_EQ(first.data()[i], replica.data()[i]);
+      EXPECT_NEAR(params.data()[i], replica.data()[i], 1e-12);
+    }
+  }
+  auto stats = trainer.epoch(xt, yt, 16);
+  EXPECT_GT(stats.accuracy, 0.0);
+}
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <ugrad/engine.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::GemmEpilogue;
+using ugrad::GemmIsa;
+
+static vector<double> random_vector(size_t size, unsigned seed) {
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  vector<double> out(size);
+  for (auto& v : out) {
+    v = dist(rng);
+  }
+  return out;
+}
+
+// restores the dispatched micro-kernel at the end of a test
+struct IsaGuard {
+  ~IsaGuard() { ugrad::set_gemm_isa(_isa); }
+  GemmIsa _isa = ugrad::gemm_isa();
+};
+
+static void expect_matches_reference(size_t m, size_t n, size_t k,
+                                     bool trans_a, bool trans_b) {
+  auto a = random_vector(m * k, 1);
+  auto b = random_vector(k * n, 2);
+  vector<double> expected(m * n);
+  ugrad::gemm_reference(trans_a, trans_b, m, n, k, a.data(), b.data(),
+                        expected.data());
+  vector<double> c(m * n, 123.0);
+  ugrad::gemm(trans_a, trans_b, m, n, k, a.data(), b.data(), c.data());
+  for (size_t i = 0; i < m * n; ++i) {
+    ASSERT_NEAR(expected[i], c[i], 1e-9)
+        << m << "x" << n << "x" << k << " trans " << trans_a << trans_b
+        << " at " << i;
+  }
+}
+
+// shapes around the tile and block edges of every kernel, square and skinny
+static const vector<std::tuple<size_t, size_t, size_t>> kShapes = {
+    {1, 1, 1},    {3, 5, 2},    {7, 9, 13},  {8, 24, 16},  {13, 25, 300},
+    {130, 17, 5}, {33, 100, 1}, {1, 517, 64}, {257, 3, 129}, {64, 64, 64}};
+
+TEST(GemmTest, MatchesReference) {
+  for (auto [m, n, k] : kShapes) {
+    for (auto trans_a : {false, true}) {
+      for (auto trans_b : {false, true}) {
+        expect_matches_reference(m, n, k, trans_a, trans_b);
+      }
+    }
+  }
+}
+
+TEST(GemmTest, EveryIsa) {
+  IsaGuard guard;
+  for (auto isa :
+       {GemmIsa::Scalar, GemmIsa::SSE2, GemmIsa::AVX2, GemmIsa::AVX512}) {
+    if (!ugrad::gemm_supports(isa)) {
+      continue;
+    }
+    ugrad::set_gemm_isa(isa);
+    EXPECT_EQ(isa, ugrad::gemm_kernel(isa).isa);
+    for (auto [m, n, k] : kShapes) {
+      expect_matches_reference(m, n, k, false, false);
+      expect_matches_reference(m, n, k, true, true);
+    }
+  }
+}
+
+TEST(GemmTest, Accumulate) {
+  const size_t m = 19, n = 31, k = 400;
+  auto a = random_vector(m * k, 3);
+  auto b = random_vector(k * n, 4);
+  auto c = random_vector(m * n, 5);
+  auto expected = c;
+  vector<double> product(m * n);
+  ugrad::gemm_reference(false, false, m, n, k, a.data(), b.data(),
+                        product.data());
+  for (size_t i = 0; i < m * n; ++i) {
+    expected[i] += product[i];
+  }
+  ugrad::gemm(false, false, m, n, k, a.data(), b.data(), c.data(), true);
+  for (size_t i = 0; i < m * n; ++i) {
+    EXPECT_NEAR(expected[i], c[i], 1e-9);
+  }
+}
+
+TEST(GemmTest, EmptyDepth) {
+  vector<double> c(6, 5.0);
+  ugrad::gemm(false, false, 2, 3, 0, nullptr, nullptr, c.data());
+  EXPECT_EQ(vector<double>(6, 0.0), c);
+}
+
+TEST(GemmTest, BiasReluEpilogue) {
+  const size_t m = 37, n = 29, k = 300;
+  auto a = random_vector(m * k, 6);
+  auto b = random_vector(k * n, 7);
+  auto bias = random_vector(n, 8);
+  vector<double> expected(m * n);
+  ugrad::gemm_reference(false, false, m, n, k, a.data(), b.data(),
+                        expected.data());
+  GemmEpilogue epilogue;
+  epilogue.bias = bias.data();
+  vector<double> c(m * n);
+  ugrad::gemm(false, false, m, n, k, a.data(), b.data(), c.data(), false,
+              epilogue);
+  for (size_t i = 0; i < m * n; ++i) {
+    EXPECT_NEAR(expected[i] + bias[i % n], c[i], 1e-9);
+  }
+  epilogue.relu = true;
+  ugrad::gemm(false, false, m, n, k, a.data(), b.data(), c.data(), false,
+              epilogue);
+  for (size_t i = 0; i < m * n; ++i) {
+    EXPECT_NEAR(std::max(expected[i] + bias[i % n], 0.0), c[i], 1e-9);
+  }
+}
+
+TEST(GemmTest, Threaded) {
+  ugrad::set_num_threads(4);
+  const size_t m = 300, n = 200, k = 150;
+  ASSERT_GE(m * n * k, ugrad::kGemmMinParallelWork);
+  for (auto trans_a : {false, true}) {
+    expect_matches_reference(m, n, k, trans_a, !trans_a);
+  }
+  ugrad::set_num_threads(1);
+  expect_matches_reference(m, n, k, false, false);
+}
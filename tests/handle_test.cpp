@@ -0,0 +1,101 @@
+// Built with UGRAD_INTRUSIVE_PTR: ValuePtr is ugrad::Ref<Value>.
+#include <gtest/gtest.h>
+
+#include <ugrad/engine.hpp>
+#include <ugrad/nn.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::make_shared;
+using ugrad::MLP;
+using ugrad::Ref;
+using ugrad::SlabAllocator;
+using ugrad::Value;
+using ugrad::ValuePtr;
+
+static_assert(std::is_same<ValuePtr, Ref<Value>>::value,
+              "handle_test must be built with UGRAD_INTRUSIVE_PTR");
+
+TEST(HandleTest, RefCount) {
+  auto a = make_shared<Value>(1.0);
+  EXPECT_EQ(1, a.use_count());
+  auto b = a;
+  EXPECT_EQ(2, a.use_count());
+  auto c = std::move(b);
+  EXPECT_FALSE(b);
+  EXPECT_EQ(2, c.use_count());
+  c.reset();
+  EXPECT_EQ(1, a.use_count());
+  EXPECT_EQ(a, a->shared_from_this());
+}
+
+TEST(HandleTest, SlabRecycles) {
+  auto live = SlabAllocator::live();
+  const Value* first = nullptr;
+  {
+    auto a = make_shared<Value>(1.0);
+    first = a.get();
+    EXPECT_EQ(live + 1, SlabAllocator::live());
+  }
+  EXPECT_EQ(live, SlabAllocator::live());
+  auto b = make_shared<Value>(2.0);
+  EXPECT_EQ(first, b.get());
+}
+
+TEST(HandleTest, GraphReleased) {
+  auto live = SlabAllocator::live();
+  {
+    auto a = make_shared<Value>(-4.0);
+    auto b = make_shared<Value>(2.0);
+    auto c = (a * b + b->pow(3.0))->relu() - a / b;
+    c->backward();
+    EXPECT_GT(SlabAllocator::live(), live);
+  }
+  EXPECT_EQ(live, SlabAllocator::live());
+}
+
+TEST(HandleTest, DropLongChain) {
+  auto live = SlabAllocator::live();
+  {
+    auto x = make_shared<Value>(0.0);
+    for (auto i = 0; i < 1000000; ++i) {
+      x = x + 1.0;
+    }
+  }
+  EXPECT_EQ(live, SlabAllocator::live());
+}
+
+TEST(HandleTest, MoreOps) {
+  auto a = make_shared<Value>(-4.0);
+  auto b = make_shared<Value>(2.0);
+  auto c = a + b;
+  auto d = a * b + b * b * b;
+  c = c + c + 1;
+  c = c + 1 + c + (-a);
+  d = d + d * 2 + (b + a)->relu();
+  d = d + 3 * d + (b - a)->relu();
+  auto e = c - d;
+  auto f = e * e;
+  auto g = f / 2.0;
+  g = g + 10.0 / f;
+  g->backward();
+  EXPECT_FLOAT_EQ(g->data(), 24.704082);
+  EXPECT_FLOAT_EQ(a->grad(), 138.833819);
+  EXPECT_FLOAT_EQ(b->grad(), 645.577259);
+}
+
+TEST(HandleTest, MLP) {
+  auto n = MLP(2, {4, 4, 1}, true);
+  auto x = vector<ValuePtr>{make_shared<Value>(1.0), make_shared<Value>(2.0)};
+  auto y = n(x);
+  EXPECT_EQ(48.0, y[0]->data());
+  n.zero_grad();
+  y[0]->backward();
+  for (auto p : n.parameters()) {
+    auto& t = p->tensor();
+    for (size_t i = 0; i < t.size(); ++i) {
+      EXPECT_GT(t.grad()[i], 0.0);
+    }
+  }
+  EXPECT_EQ(16.0, x[0]->grad());
+}
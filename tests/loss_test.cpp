@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <functional>
+#include <random>
+#include <ugrad/engine.hpp>
+#include <ugrad/loss.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::ValuePtr;
+namespace loss = ugrad::loss;
+
+using LossFn = std::function<loss::Result(const ValuePtr&, const ValuePtr&)>;
+
+static vector<double> random_scores(size_t size, unsigned seed) {
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<> dist{-2.0, 2.0};
+  vector<double> out(size);
+  for (auto& v : out) {
+    v = dist(rng);
+  }
+  return out;
+}
+
+// the grads of backward against central differences of the loss
+static void expect_grads(const LossFn& fn, size_t rows, size_t cols,
+                         const ValuePtr& targets) {
+  auto data = random_scores(rows * cols, 7);
+  auto scores = ugrad::make_tensor(rows, cols, data);
+  fn(scores, targets).loss->backward();
+  const double h = 1e-6;
+  for (size_t i = 0; i < data.size(); ++i) {
+    ugrad::NoGradGuard no_grad;
+    auto up = data, down = data;
+    up[i] += h;
+    down[i] -= h;
+    auto f_up = fn(ugrad::make_tensor(rows, cols, up), targets).loss->data();
+    auto f_down =
+        fn(ugrad::make_tensor(rows, cols, down), targets).loss->data();
+    EXPECT_NEAR((f_up - f_down) / (2 * h), scores->tensor().grad()[i], 1e-6)
+        << i;
+  }
+}
+
+TEST(LossTest, Hinge) {
+  auto scores = ugrad::make_tensor(4, 1, {2.0, 0.5, -0.5, -3.0});
+  auto targets = ugrad::make_tensor(4, 1, {1.0, 1.0, 1.0, -1.0}, false);
+  auto [l, accuracy] = loss::hinge(scores, targets);
+  EXPECT_DOUBLE_EQ((0.0 + 0.5 + 1.5 + 0.0) / 4, l->data());
+  EXPECT_DOUBLE_EQ(0.75, accuracy);
+  EXPECT_EQ(2, l->children().size());
+  l->backward();
+  EXPECT_EQ(0.0, scores->tensor().grad()[0]);
+  EXPECT_EQ(-0.25, scores->tensor().grad()[1]);
+  EXPECT_EQ(0.0, scores->tensor().grad()[3]);
+
+  auto y = ugrad::make_tensor(6, 1, {1, -1, 1, 1, -1, -1}, false);
+  expect_grads(loss::hinge, 6, 1, y);
+}
+
+TEST(LossTest, MSE) {
+  auto targets = ugrad::make_tensor(3, 2, random_scores(6, 3), false);
+  expect_grads(loss::mse, 3, 2, targets);
+  auto scores = ugrad::make_tensor(2, 2, {1.0, 0.0, 0.0, 3.0});
+  auto one_hot = ugrad::make_tensor(2, 2, {1.0, 0.0, 1.0, 0.0}, false);
+  auto [l, accuracy] = loss::mse(scores, one_hot);
+  EXPECT_DOUBLE_EQ((0.0 + 0.0 + 1.0 + 9.0) / 4, l->data());
+  EXPECT_DOUBLE_EQ(0.5, accuracy);
+}
+
+TEST(LossTest, Logistic) {
+  auto y = ugrad::make_tensor(6, 1, {1, -1, 1, 1, -1, -1}, false);
+  expect_grads(loss::logistic, 6, 1, y);
+  // large margins neither overflow nor lose the small loss
+  auto scores = ugrad::make_tensor(2, 1, {800.0, -800.0});
+  auto [l, accuracy] = loss::logistic(scores, ugrad::make_tensor(
+                                                  2, 1, {-1.0, -1.0}, false));
+  EXPECT_DOUBLE_EQ(400.0, l->data());
+  EXPECT_DOUBLE_EQ(0.5, accuracy);
+}
+
+TEST(LossTest, SoftmaxCrossEntropy) {
+  auto labels = ugrad::make_tensor(4, 1, {0, 2, 1, 2}, false);
+  expect_grads(loss::softmax_cross_entropy, 4, 3, labels);
+
+  // shifted by a constant the logits give the same loss, without overflow
+  auto logits = ugrad::make_tensor(2, 3, {1000, 1001, 1002, 0, 1, 2});
+  auto [l, accuracy] = loss::softmax_cross_entropy(
+      logits, ugrad::make_tensor(2, 1, {2, 0}, false));
+  auto lse = std::log(1 + std::exp(1.0) + std::exp(2.0));
+  EXPECT_NEAR((lse - 2 + lse) / 2, l->data(), 1e-12);
+  EXPECT_DOUBLE_EQ(0.5, accuracy);
+  l->backward();
+  double row_sum = 0.0;
+  for (size_t j = 0; j < 3; ++j) {
+    row_sum += logits->tensor().grad()[j];
+  }
+  EXPECT_NEAR(0.0, row_sum, 1e-12);
+}
+
+TEST(LossTest, NoGrad) {
+  ugrad::NoGradGuard no_grad;
+  auto scores = ugrad::make_tensor(2, 1, {1.0, -1.0});
+  auto [l, accuracy] =
+      loss::hinge(scores, ugrad::make_tensor(2, 1, {1.0, 1.0}, false));
+  EXPECT_DOUBLE_EQ(1.0, l->data());
+  EXPECT_TRUE(l->children().empty());
+  EXPECT_DOUBLE_EQ(0.5, accuracy);
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <ugrad/multiprocess.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::DataParallelTrainer;
+using ugrad::LayerKind;
+using ugrad::MLP;
+using ugrad::ParameterView;
+using ugrad::ProcessGroup;
+using ugrad::SharedSegment;
+using ugrad::ShmCommunicator;
+namespace optim = ugrad::optim;
+
+// each rank checks the sums itself, the parent reads the slots afterwards
+TEST(ProcessGroupTest, AllReduce) {
+  const size_t ranks = 3, n = 37;
+  ProcessGroup group{ranks, n};
+  ASSERT_TRUE(group);
+  auto ok = group.run([&](ShmCommunicator& comm) {
+    for (size_t round = 0; round < 3; ++round) {
+      for (size_t i = 0; i < n; ++i) {
+        comm.slot()[i] = static_cast<double>((comm.rank() + 1) * i + round);
+      }
+      comm.all_reduce(n, 8);
+      for (size_t i = 0; i < n; ++i) {
+        if (comm.slot()[i] != static_cast<double>(6 * i + 3 * round)) {
+          return 1;
+        }
+      }
+    }
+    return 0;
+  });
+  EXPECT_TRUE(ok);
+  for (size_t r = 0; r < ranks; ++r) {
+    EXPECT_EQ(6.0 * 5 + 6, group.communicator(0).slot(r)[5]);
+  }
+}
+
+// the other ranks wait on a barrier the failed one never reaches
+TEST(ProcessGroupTest, FailedRank) {
+  ProcessGroup group{3, 1};
+  ASSERT_TRUE(group);
+  auto ok = group.run([](ShmCommunicator& comm) {
+    if (comm.rank() == 1) {
+      return 2;
+    }
+    comm.arrive_and_wait();
+    return 0;
+  });
+  EXPECT_FALSE(ok);
+}
+
+// counts the processes that get past run(), each rank would if it escaped
+static bool run_counting(ProcessGroup& group,
+                         const std::function<int(ShmCommunicator&)>& body,
+                         int& passed) {
+  SharedSegment counter{sizeof(std::atomic<int>)};
+  auto count = new (counter.data()) std::atomic<int>{0};
+  auto parent = getpid();
+  bool ok = true;
+  try {
+    ok = group.run(body);
+  } catch (...) {
+  }
+  count->fetch_add(1);
+  if (getpid() != parent) {
+    _exit(0);
+  }
+  passed = count->load();
+  return ok;
+}
+
+// a throwing rank fails the run and never unwinds into the caller
+TEST(ProcessGroupTest, ThrowingRank) {
+  ProcessGroup group{3, 1};
+  ASSERT_TRUE(group);
+  int passed = 0;
+  auto ok = run_counting(
+      group,
+      [](ShmCommunicator&) -> int { throw std::runtime_error("rank failed"); },
+      passed);
+  EXPECT_FALSE(ok);
+  EXPECT_EQ(1, passed);
+}
+
+// ranks free their graphs in place, the parent's reclaimer thread is gone
+TEST(ProcessGroupTest, DeferredTeardown) {
+  ugrad::Reclaimer::set_deferred(true);
+  ProcessGroup group{2, 1};
+  ASSERT_TRUE(group);
+  int passed = 0;
+  auto ok = run_counting(
+      group,
+      [](ShmCommunicator& comm) {
+        if (ugrad::Reclaimer::deferred()) {
+          return 1;
+        }
+        for (size_t step = 0; step < 100; ++step) {
+          auto x = std::make_shared<ugrad::Value>(1.0);
+          for (size_t i = 0; i < 1000; ++i) {
+            x = x * 1.0;
+          }
+        }
+        comm.arrive_and_wait();
+        return 0;
+      },
+      passed);
+  ugrad::Reclaimer::set_deferred(false);
+  EXPECT_TRUE(ok);
+  EXPECT_EQ(1, passed);
+}
+
+// the same steps on three processes and on three threads
+TEST(ProcessGroupTest, MatchesThreads) {
+  const size_t rows = 60;
+  std::mt19937 rng{5};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  vector<double> x(rows * 2), y(rows);
+  for (size_t i = 0; i < rows; ++i) {
+    x[2 * i] = dist(rng);
+    x[2 * i + 1] = dist(rng);
+    y[i] = x[2 * i] * x[2 * i + 1] > 0 ? 1.0 : -1.0;
+  }
+  ugrad::Tensor xt{rows, 2, x}, yt{rows, 1, y};
+  auto make_sgd = [](ParameterView params) {
+    return std::make_unique<optim::SGD>(params, 0.1, 0.9);
+  };
+  DataParallelTrainer trainer{3, 2, {8, 1}, LayerKind::Linear, make_sgd};
+  MLP model{2, {8, 1}, LayerKind::Linear};
+  auto params = model.parameters();
+  auto expected = trainer.model().parameters();
+  std::copy(expected.data(), expected.data() + expected.numel(),
+            params.data());
+  auto sgd = make_sgd(params);
+
+  auto stats = ugrad::train_processes(3, model, *sgd, xt, yt, 16, 2);
+  ASSERT_EQ(2, stats.size());
+  for (auto& epoch : stats) {
+    auto threads = trainer.epoch(xt, yt, 16);
+    EXPECT_NEAR(threads.loss, epoch.loss, 1e-12);
+    EXPECT_NEAR(threads.accuracy, epoch.accuracy, 1e-12);
+  }
+  for (size_t i = 0; i < params.numel(); ++i) {
+    EXPECT_NEAR(expected.data()[i], params.data()[i], 1e-12);
+  }
+}
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <fstream>
 #include <memory>
+#include <thread>
 #include <ugrad/engine.hpp>
 #include <ugrad/nn.hpp>
 #include <vector>
@@ -8,16 +12,33 @@
 using std::make_shared;
 using std::vector;
 using ugrad::Layer;
+using ugrad::LayerKind;
+using ugrad::Linear;
 using ugrad::MLP;
 using ugrad::Module;
 using ugrad::Neuron;
 using ugrad::Value;
 using ugrad::ValuePtr;
+using std::weak_ptr;
 
 constexpr bool static is_test = true;
 constexpr bool static relu_act = true;
 constexpr bool static no_act = false;
 
+// every parameter grad of a module, tensor parameters flattened
+static vector<double> grads(Module& module) {
+  vector<double> out;
+  for (auto& p : module.parameters()) {
+    if (!p->is_tensor()) {
+      out.push_back(p->grad());
+      continue;
+    }
+    auto& t = p->tensor();
+    out.insert(out.end(), t.grad(), t.grad() + t.size());
+  }
+  return out;
+}
+
 TEST(NeuronTest, ReluAct) {
   auto n = Neuron(2, relu_act, is_test);
   auto x = vector<ValuePtr>{make_shared<Value>(1.0), make_shared<Value>(-2.0)};
@@ -38,11 +59,43 @@ TEST(NeuronTest, TopoSort) {
   auto y = n(x);
   EXPECT_EQ(0, y->data());
   auto topo_sort = y->build_topo();
-  ASSERT_EQ(10, topo_sort.size());
-  const double target[10] = {0.0, -1.0, 0.0, -1.0, -2.0, 1, -2, 1.0, 1.0, 1.0};
-  for (auto i = 0; i < 10; ++i) {
-    EXPECT_EQ(target[i], topo_sort[i]->data());
+  // the fused neuron node, x[1], x[0], the weights and bias
+  ASSERT_EQ(4, topo_sort.size());
+  EXPECT_EQ(ugrad::Op::Neuron, topo_sort[0]->op());
+  EXPECT_EQ(-2.0, topo_sort[1]->data());
+  EXPECT_EQ(1.0, topo_sort[2]->data());
+  ASSERT_TRUE(topo_sort[3]->is_tensor());
+  EXPECT_EQ(3, topo_sort[3]->tensor().size());
+}
+
+// the fused node gets the grads of the same neuron built from scalar nodes
+TEST(NeuronTest, Backward) {
+  const size_t in_nr = 37;
+  auto n = Neuron(in_nr);
+  vector<ValuePtr> x, sx;
+  for (size_t i = 0; i < in_nr; ++i) {
+    x.push_back(make_shared<Value>(0.1 * i - 1.0));
+    sx.push_back(make_shared<Value>(0.1 * i - 1.0));
   }
+  auto& w = n._w->tensor();
+  // keep the relu open
+  w.data()[in_nr] = 100.0;
+  vector<ValuePtr> sw;
+  for (size_t i = 0; i <= in_nr; ++i) {
+    sw.push_back(make_shared<Value>(w.data()[i]));
+  }
+  auto bias = sw.back();
+  sw.pop_back();
+  auto y = n(x)->pow(2.0);
+  auto sy = (ugrad::dot(sx, sw) + bias)->relu()->pow(2.0);
+  EXPECT_NEAR(sy->data(), y->data(), 1e-9);
+  y->backward();
+  sy->backward();
+  for (size_t i = 0; i < in_nr; ++i) {
+    EXPECT_NEAR(sw[i]->grad(), w.grad()[i], 1e-9);
+    EXPECT_NEAR(sx[i]->grad(), x[i]->grad(), 1e-9);
+  }
+  EXPECT_NEAR(bias->grad(), w.grad()[in_nr], 1e-9);
 }
 
 TEST(LayerTest, ReluAct) {
@@ -76,11 +129,13 @@ TEST(LayerTest, TopoSort) {
   ASSERT_EQ(out_nr, y.size());
   EXPECT_EQ(0, y[0]->data());
   auto topo_sort = y[0]->build_topo();
-  ASSERT_EQ(10, topo_sort.size());
-  const double target[10] = {0.0, -1.0, 0.0, -1.0, -2.0, 1, -2, 1.0, 1.0, 1.0};
-  for (auto i = 0; i < 10; ++i) {
-    EXPECT_EQ(target[i], topo_sort[i]->data());
-  }
+  // the fused neuron node, x[1], x[0], the weights and bias
+  ASSERT_EQ(4, topo_sort.size());
+  EXPECT_EQ(ugrad::Op::Neuron, topo_sort[0]->op());
+  EXPECT_EQ(-2.0, topo_sort[1]->data());
+  EXPECT_EQ(1.0, topo_sort[2]->data());
+  ASSERT_TRUE(topo_sort[3]->is_tensor());
+  EXPECT_EQ(3, topo_sort[3]->tensor().size());
 }
 
 TEST(LayerTest, NoAct) {
@@ -125,4 +180,337 @@ TEST(MLPTest, ReluActPos) {
   EXPECT_EQ(48.0, y[0]->data());
 }
 
-TEST(MLPTest, TopoSort) {}
\ No newline at end of file
+TEST(MLPTest, TopoSort) {}
+
+TEST(MLPTest, GraphReleased) {
+  auto n = MLP(2, {4, 4, 1}, is_test);
+  auto x = vector<ValuePtr>{make_shared<Value>(1.0), make_shared<Value>(2.0)};
+  weak_ptr<Value> root;
+  {
+    auto y = n(x)[0]->relu();
+    y->backward();
+    root = y;
+  }
+  EXPECT_TRUE(root.expired());
+}
+
+// resident set size in bytes, 0 if it cannot be determined on this platform
+static size_t resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  auto page = sysconf(_SC_PAGESIZE);
+  if (!(statm >> pages >> resident) || page <= 0) {
+    return 0;
+  }
+  return resident * static_cast<size_t>(page);
+}
+
+TEST(MLPTest, TrainingMemoryFlat) {
+  if (resident_bytes() == 0) {
+    GTEST_SKIP() << "resident memory is not observable on this platform";
+  }
+  auto model = MLP(2, {4, 1});
+  auto X = vector<vector<ValuePtr>>{};
+  auto y = vector<double>{};
+  for (auto i = 0; i < 4; ++i) {
+    X.push_back({make_shared<Value>(i * 0.25), make_shared<Value>(1.0 - i)});
+    y.push_back(i % 2 ? 1.0 : -1.0);
+  }
+
+  auto epoch = [&]() {
+    auto total = make_shared<Value>(0.0);
+    for (size_t i = 0; i < X.size(); ++i) {
+      total = total + (model(X[i])[0] * (-y[i]) + 1.0)->relu();
+    }
+    model.zero_grad();
+    total->backward();
+    for (auto p : model.parameters()) {
+      auto& t = p->tensor();
+      for (size_t i = 0; i < t.size(); ++i) {
+        t.data()[i] -= 0.01 * t.grad()[i];
+      }
+    }
+  };
+
+  // let the allocator reach its steady state before taking the baseline
+  for (auto i = 0; i < 200; ++i) {
+    epoch();
+  }
+  auto baseline = resident_bytes();
+  for (auto i = 0; i < 2000; ++i) {
+    epoch();
+  }
+  // a leaking graph grows by tens of megabytes over these epochs
+  EXPECT_LT(resident_bytes(), baseline + (4 << 20));
+}
+
+TEST(MLPTest, NoGrad) {
+  auto n = MLP(2, {4, 4, 1}, is_test);
+  auto x = vector<ValuePtr>{make_shared<Value>(1.0), make_shared<Value>(2.0)};
+  auto y = n(x);
+  ugrad::NoGradGuard no_grad;
+  auto y_no_grad = n(x);
+  ASSERT_EQ(1, y_no_grad.size());
+  EXPECT_EQ(y[0]->data(), y_no_grad[0]->data());
+  EXPECT_TRUE(y_no_grad[0]->children().empty());
+  EXPECT_FALSE(y_no_grad[0]->requires_grad());
+}
+
+// per-sample graphs differentiated on several threads against shared
+// parameters add up to the same grads as a serial pass
+TEST(MLPTest, ConcurrentBackward) {
+  const size_t threads = 4, samples = 64;
+  auto n = MLP(2, {8, 8, 1});
+  auto sample_loss = [&](size_t i) {
+    auto x = vector<ValuePtr>{make_shared<Value>(0.1 * i, false),
+                              make_shared<Value>(1.0 - 0.05 * i, false)};
+    return n(x)[0]->pow(2.0);
+  };
+  for (size_t i = 0; i < samples; ++i) {
+    sample_loss(i)->backward();
+  }
+  auto expected = grads(n);
+
+  auto check = [&] {
+    auto actual = grads(n);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-9);
+    }
+  };
+  auto run = [&](auto per_thread) {
+    n.zero_grad();
+    vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back(per_thread, t);
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  };
+
+  run([&](size_t t) {
+    ugrad::AtomicGradGuard atomic;
+    for (auto i = t; i < samples; i += threads) {
+      sample_loss(i)->backward();
+    }
+  });
+  check();
+
+  vector<ugrad::GradShard> shards(threads);
+  run([&](size_t t) {
+    ugrad::ShardedGradGuard sharded{shards[t]};
+    for (auto i = t; i < samples; i += threads) {
+      sample_loss(i)->backward();
+    }
+  });
+  for (auto& shard : shards) {
+    shard.merge();
+  }
+  check();
+}
+
+TEST(MLPTest, ParallelBackward) {
+  auto n = MLP(16, {32, 32, 1});
+  vector<ValuePtr> x;
+  for (auto i = 0; i < 16; ++i) {
+    x.push_back(make_shared<Value>(0.1 * i - 0.8, false));
+  }
+  n(x)[0]->backward();
+  auto expected = grads(n);
+  n.zero_grad();
+  ugrad::ThreadPool pool{4};
+  n(x)[0]->backward(pool);
+  auto actual = grads(n);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < actual.size(); ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-9);
+  }
+}
+
+// a layer big enough to be split over the default pool builds the same graph
+TEST(LayerTest, Parallel) {
+  auto threads = ugrad::num_threads();
+  auto layer = Layer(64, 256);
+  vector<ValuePtr> x;
+  for (auto i = 0; i < 64; ++i) {
+    x.push_back(make_shared<Value>(0.05 * i - 1.0));
+  }
+  ugrad::set_num_threads(1);
+  auto serial = layer(x);
+  ugrad::set_num_threads(4);
+  auto parallel = layer(x);
+  ASSERT_EQ(serial.size(), parallel.size());
+  for (size_t i = 0; i < serial.size(); ++i) {
+    EXPECT_EQ(serial[i]->data(), parallel[i]->data());
+  }
+  {
+    ugrad::NoGradGuard no_grad;
+    for (auto& y : layer(x)) {
+      EXPECT_TRUE(y->children().empty());
+    }
+  }
+  ugrad::set_num_threads(threads);
+}
+
+// a batch through Neuron, Layer and MLP matches sample by sample, in values
+// and in the grads of parameters and inputs
+TEST(MLPTest, BatchForward) {
+  const size_t batch = 5, in_nr = 3;
+  auto n = MLP(in_nr, {8, 6, 1});
+  vector<double> data(batch * in_nr);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = 0.3 * i - 2.0;
+  }
+  auto x = ugrad::make_tensor(batch, in_nr, data);
+  auto y = n(x);
+  ASSERT_EQ(ugrad::Op::Dense, y->op());
+  ASSERT_EQ(batch, y->tensor().rows());
+  ASSERT_EQ(1, y->tensor().cols());
+  ugrad::sum(y)->backward();
+  auto batch_grads = grads(n);
+
+  n.zero_grad();
+  vector<ValuePtr> xs, outs;
+  for (auto v : data) {
+    xs.push_back(make_shared<Value>(v));
+  }
+  for (size_t i = 0; i < batch; ++i) {
+    auto sample = vector<ValuePtr>(xs.begin() + i * in_nr,
+                                   xs.begin() + (i + 1) * in_nr);
+    outs.push_back(n(sample)[0]);
+    EXPECT_NEAR(outs.back()->data(), y->tensor().at(i, 0), 1e-12);
+    EXPECT_NEAR(n._layers[0]._neurons[2](sample)->data(),
+                n._layers[0]._neurons[2](ugrad::stack(sample))->tensor().at(0, 0),
+                1e-12);
+  }
+  ugrad::sum(outs)->backward();
+  auto sample_grads = grads(n);
+  ASSERT_EQ(sample_grads.size(), batch_grads.size());
+  for (size_t i = 0; i < sample_grads.size(); ++i) {
+    EXPECT_NEAR(sample_grads[i], batch_grads[i], 1e-9);
+  }
+  for (size_t i = 0; i < xs.size(); ++i) {
+    EXPECT_NEAR(xs[i]->grad(), x->tensor().grad()[i], 1e-9);
+  }
+
+  ugrad::NoGradGuard no_grad;
+  auto layer_out = n._layers[0](x);
+  EXPECT_EQ(8, layer_out->tensor().cols());
+  EXPECT_TRUE(layer_out->children().empty());
+}
+
+// every parameter of a model lives in one aligned buffer, each submodule
+// viewing its contiguous part of it
+TEST(ParameterTest, Contiguous) {
+  auto n = MLP(2, {16, 16, 1});
+  auto params = n.parameters();
+  ASSERT_EQ(33, params.size());
+  EXPECT_EQ(337, params.numel());
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(params.data()) % 64);
+  size_t offset = 0;
+  for (auto& p : params) {
+    EXPECT_EQ(params.data() + offset, p->tensor().data());
+    EXPECT_EQ(params.grad() + offset, p->tensor().grad());
+    offset += p->tensor().size();
+  }
+  // a view, not a copy
+  EXPECT_EQ(params.begin(), n.parameters().begin());
+  auto second = n._layers[1].parameters();
+  EXPECT_EQ(16, second.size());
+  EXPECT_EQ(params.data() + 16 * 3, second.data());
+  EXPECT_EQ(params.data() + 16 * 3, n._layers[1]._neurons[0].parameters().data());
+
+  auto x = vector<ValuePtr>{make_shared<Value>(0.5), make_shared<Value>(-1.5)};
+  n(x)[0]->backward();
+  n._layers[1].zero_grad();
+  for (size_t i = 0; i < second.numel(); ++i) {
+    EXPECT_EQ(0.0, second.grad()[i]);
+  }
+  n.zero_grad();
+  for (size_t i = 0; i < params.numel(); ++i) {
+    EXPECT_EQ(0.0, params.grad()[i]);
+  }
+}
+
+// a view stays valid when its module is moved and then destroyed
+TEST(ParameterTest, ViewOutlivesModule) {
+  auto first = std::make_unique<MLP>(2, vector<size_t>{4, 1});
+  auto params = first->parameters();
+  auto data = params.data();
+  auto moved = std::make_unique<MLP>(std::move(*first));
+  first.reset();
+  EXPECT_EQ(data, moved->parameters().data());
+  moved.reset();
+  ASSERT_EQ(5, params.size());
+  EXPECT_EQ(data, params.data());
+  EXPECT_EQ(data, params[0]->tensor().data());
+  params.zero_grad();
+}
+
+// the fused penalty against the grads it stands for, 2 * coefficient * p,
+// through the single axpy and through the per-tensor path
+TEST(ParameterTest, L2Penalty) {
+  auto n = MLP(2, {4, 1});
+  auto params = n.parameters();
+  double expected = 0.0;
+  for (size_t i = 0; i < params.numel(); ++i) {
+    expected += params.data()[i] * params.data()[i];
+  }
+  auto check = [&](const ValuePtr& penalty) {
+    EXPECT_NEAR(0.5 * expected, penalty->data(), 1e-12);
+    n.zero_grad();
+    penalty->backward();
+    for (size_t i = 0; i < params.numel(); ++i) {
+      EXPECT_NEAR(params.data()[i], params.grad()[i], 1e-12);
+    }
+  };
+  check(ugrad::l2_penalty(params, 0.5));
+  {
+    ugrad::AtomicGradGuard atomic;
+    check(ugrad::l2_penalty(params, 0.5));
+  }
+  // out of order, the tensors are no longer one range
+  vector<ValuePtr> reversed(params.begin(), params.end());
+  std::reverse(reversed.begin(), reversed.end());
+  check(ugrad::l2_penalty(reversed, 0.5));
+}
+
+TEST(LinearTest, Batch) {
+  auto l = Linear(2, 3, relu_act, is_test);
+  auto x = ugrad::make_tensor(2, 2, {1.0, -2.0, 1.0, 2.0}, false);
+  auto y = l(x);
+  ASSERT_EQ(2, y->tensor().rows());
+  ASSERT_EQ(3, y->tensor().cols());
+  for (size_t j = 0; j < 3; ++j) {
+    EXPECT_EQ(0.0, y->tensor().at(0, j));
+    EXPECT_EQ(3.0, y->tensor().at(1, j));
+  }
+  EXPECT_EQ(2, l.parameters().size());
+}
+
+// with the same weights a Linear MLP computes what the scalar one does
+TEST(MLPTest, LinearLayers) {
+  auto scalar = MLP(2, {4llu, 4llu, 1llu}, is_test);
+  auto tensor = MLP(2, {4llu, 4llu, 1llu}, LayerKind::Linear, is_test);
+  auto x = vector<ValuePtr>{make_shared<Value>(1.0), make_shared<Value>(2.0)};
+  auto y = tensor(x);
+  ASSERT_EQ(1, y.size());
+  EXPECT_EQ(scalar(x)[0]->data(), y[0]->data());
+  EXPECT_EQ(48.0, y[0]->data());
+
+  y[0]->backward();
+  EXPECT_EQ(x[0]->grad(), 16.0);
+  auto params = tensor.parameters();
+  ASSERT_EQ(6, params.size());
+  // the output bias
+  EXPECT_EQ(1.0, params[5]->tensor().grad()[0]);
+  tensor.zero_grad();
+  EXPECT_EQ(0.0, params[0]->tensor().grad()[0]);
+
+  auto batch = ugrad::make_tensor(3, 2, {1, 2, 1, -2, 0, 0}, false);
+  auto out = tensor(batch);
+  ASSERT_EQ(3, out->tensor().rows());
+  EXPECT_EQ(48.0, out->tensor().at(0, 0));
+  EXPECT_EQ(0.0, out->tensor().at(1, 0));
+}
@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <ugrad/nn.hpp>
+#include <ugrad/optim.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::Linear;
+using ugrad::ParameterView;
+using ugrad::SimdIsa;
+namespace optim = ugrad::optim;
+
+// restores the dispatched kernels at the end of a test
+struct IsaGuard {
+  ~IsaGuard() { ugrad::set_vector_isa(_isa); }
+  SimdIsa _isa = ugrad::vector_isa();
+};
+
+// random weights and grads, so every element takes a different path
+static void randomize(const ParameterView& params, unsigned seed) {
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  for (size_t i = 0; i < params.numel(); ++i) {
+    params.data()[i] = dist(rng);
+    params.grad()[i] = dist(rng);
+  }
+}
+
+static vector<double> data(const ParameterView& params) {
+  return {params.data(), params.data() + params.numel()};
+}
+
+// Element-wise reference of the update rules, written as in the papers.
+struct Reference {
+  explicit Reference(const ParameterView& params)
+      : p{data(params)},
+        m(params.numel()),
+        v(params.numel()),
+        g{params.grad(), params.grad() + params.numel()} {}
+
+  // decoupled decay shrinks p first, coupled decay goes into the grad
+  double decay(size_t i, double lr, double wd, bool decoupled) {
+    if (decoupled) {
+      p[i] -= lr * wd * p[i];
+      return g[i];
+    }
+    return g[i] + wd * p[i];
+  }
+
+  void sgd(double lr, double mu, bool nesterov, double wd, bool decoupled) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      auto d = decay(i, lr, wd, decoupled);
+      m[i] = mu * m[i] + d;
+      p[i] -= lr * (mu == 0.0 ? d : nesterov ? d + mu * m[i] : m[i]);
+    }
+  }
+
+  void adam(int t, double lr, double b1, double b2, double eps, double wd,
+            bool decoupled) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      auto grad = decay(i, lr, wd, decoupled);
+      m[i] = b1 * m[i] + (1 - b1) * grad;
+      v[i] = b2 * v[i] + (1 - b2) * grad * grad;
+      auto m_hat = m[i] / (1 - std::pow(b1, t));
+      auto v_hat = v[i] / (1 - std::pow(b2, t));
+      p[i] -= lr * m_hat / (std::sqrt(v_hat) + eps);
+    }
+  }
+
+  void rmsprop(double lr, double alpha, double eps, double wd,
+               bool decoupled) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      auto grad = decay(i, lr, wd, decoupled);
+      v[i] = alpha * v[i] + (1 - alpha) * grad * grad;
+      p[i] -= lr * grad / (std::sqrt(v[i]) + eps);
+    }
+  }
+
+  vector<double> p, m, v, g;
+};
+
+static void expect_near(const vector<double>& expected,
+                        const ParameterView& params) {
+  ASSERT_EQ(expected.size(), params.numel());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_NEAR(expected[i], params.data()[i], 1e-12) << i;
+  }
+}
+
+// 3 * 7 weights and 7 biases: the vector loops and their tails both run
+TEST(OptimTest, EveryIsa) {
+  IsaGuard guard;
+  for (auto isa :
+       {SimdIsa::Scalar, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512}) {
+    if (!ugrad::simd_supports(isa)) {
+      continue;
+    }
+    ugrad::set_vector_isa(isa);
+    for (bool decoupled : {false, true}) {
+      for (bool nesterov : {false, true}) {
+        for (double mu : {0.0, 0.9}) {
+          Linear linear{3, 7};
+          auto params = linear.parameters();
+          randomize(params, 1);
+          Reference ref{params};
+          optim::SGD sgd{params, 0.1, mu, nesterov, 1e-1, decoupled};
+          for (int t = 0; t < 3; ++t) {
+            sgd.step();
+            ref.sgd(0.1, mu, nesterov, 1e-1, decoupled);
+          }
+          expect_near(ref.p, params);
+        }
+      }
+    }
+    for (bool decoupled : {false, true}) {
+      Linear linear{3, 7};
+      auto params = linear.parameters();
+      randomize(params, 2);
+      Reference ref{params};
+      std::unique_ptr<optim::Optimizer> adam;
+      if (decoupled) {
+        adam = std::make_unique<optim::AdamW>(params, 1e-2, 0.9, 0.99, 1e-8,
+                                              0.1);
+      } else {
+        adam = std::make_unique<optim::Adam>(params, 1e-2, 0.9, 0.99, 1e-8,
+                                             0.1);
+      }
+      for (int t = 1; t <= 3; ++t) {
+        adam->step();
+        ref.adam(t, 1e-2, 0.9, 0.99, 1e-8, 0.1, decoupled);
+      }
+      EXPECT_EQ(3u, adam->steps());
+      expect_near(ref.p, params);
+    }
+    for (bool decoupled : {false, true}) {
+      Linear linear{3, 7};
+      auto params = linear.parameters();
+      randomize(params, 3);
+      Reference ref{params};
+      optim::RMSProp rmsprop{params, 1e-2, 0.9, 1e-8, 1e-1, decoupled};
+      EXPECT_EQ(decoupled, rmsprop.decoupled());
+      for (int t = 0; t < 3; ++t) {
+        rmsprop.step();
+        ref.rmsprop(1e-2, 0.9, 1e-8, 1e-1, decoupled);
+      }
+      expect_near(ref.p, params);
+    }
+  }
+}
+
+// large enough for the sweep to be split over the pool
+TEST(OptimTest, Threaded) {
+  Linear linear{300, 300};
+  auto params = linear.parameters();
+  ASSERT_GE(params.numel(), optim::Optimizer::kMinParallelWork);
+  randomize(params, 4);
+  Reference ref{params};
+  optim::Adam adam{params};
+  for (int t = 1; t <= 2; ++t) {
+    adam.step();
+    ref.adam(t, 1e-3, 0.9, 0.999, 1e-8, 0.0, false);
+  }
+  expect_near(ref.p, params);
+}
+
+TEST(OptimTest, ZeroGradAndLr) {
+  Linear linear{2, 2};
+  auto params = linear.parameters();
+  randomize(params, 5);
+  optim::SGD sgd{params, 0.5};
+  sgd.set_lr(0.25);
+  EXPECT_EQ(0.25, sgd.lr());
+  auto before = data(params);
+  sgd.step();
+  for (size_t i = 0; i < params.numel(); ++i) {
+    EXPECT_DOUBLE_EQ(before[i] - 0.25 * params.grad()[i], params.data()[i]);
+  }
+  sgd.zero_grad();
+  for (size_t i = 0; i < params.numel(); ++i) {
+    EXPECT_EQ(0.0, params.grad()[i]);
+  }
+}
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <ugrad/simd.hpp>
+#include <vector>
+
+using std::vector;
+using ugrad::SimdIsa;
+
+static vector<double> random_vector(size_t size, unsigned seed) {
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  vector<double> out(size);
+  for (auto& v : out) {
+    v = dist(rng);
+  }
+  return out;
+}
+
+// restores the dispatched kernels at the end of a test
+struct IsaGuard {
+  ~IsaGuard() { ugrad::set_vector_isa(_isa); }
+  SimdIsa _isa = ugrad::vector_isa();
+};
+
+// every length up to a few vectors past the unrolled loops, so the main
+// loops, the single-vector loops and the tails all run
+TEST(SimdTest, DotAndAxpy) {
+  IsaGuard guard;
+  for (auto isa :
+       {SimdIsa::Scalar, SimdIsa::SSE2, SimdIsa::AVX2, SimdIsa::AVX512}) {
+    if (!ugrad::simd_supports(isa)) {
+      continue;
+    }
+    ugrad::set_vector_isa(isa);
+    EXPECT_EQ(isa, ugrad::vector_isa());
+    for (size_t n = 0; n < 80; ++n) {
+      auto x = random_vector(n, 1);
+      auto y = random_vector(n + 1, 2);
+      double expected = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        expected += x[i] * y[i];
+      }
+      EXPECT_NEAR(expected, ugrad::vdot(n, x.data(), y.data()), 1e-12);
+
+      auto out = y;
+      ugrad::axpy(n, -0.5, x.data(), out.data());
+      for (size_t i = 0; i < n; ++i) {
+        EXPECT_NEAR(y[i] - 0.5 * x[i], out[i], 1e-15);
+      }
+      // nothing past the end is touched
+      EXPECT_EQ(y[n], out[n]);
+    }
+  }
+}
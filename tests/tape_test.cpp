@@ -0,0 +1,206 @@
+#include <ugrad/tape.hpp>
+#include <gtest/gtest.h>
+
+using ugrad::tape::Capture;
+using ugrad::tape::Op;
+using ugrad::tape::Tape;
+using ugrad::tape::Var;
+
+TEST(TapeTest, Add) {
+  Tape tape;
+  auto a = tape.var(-1.0);
+  auto b = tape.var(1.0);
+  auto c = a + b;
+  EXPECT_EQ(0, c.data());
+  EXPECT_EQ(Op::Add, tape.op(c.idx));
+  EXPECT_EQ(a.idx, tape.lhs(c.idx));
+  EXPECT_EQ(b.idx, tape.rhs(c.idx));
+}
+
+TEST(TapeTest, CreationOrder) {
+  Tape tape;
+  auto a = tape.var(-1.0);
+  auto b = a * a + 2.0;
+  EXPECT_EQ(4, tape.size());
+  EXPECT_EQ(3, b.idx);
+  EXPECT_EQ(3, b.data());
+}
+
+TEST(TapeTest, Reset) {
+  Tape tape;
+  auto w = tape.var(3.0);
+  auto mark = tape.size();
+  for (auto step = 0; step < 3; ++step) {
+    tape.reset(mark);
+    auto x = tape.var(step);
+    auto y = w * x + w;
+    tape.zero_grad();
+    y.backward();
+    EXPECT_EQ(4, tape.size());
+    EXPECT_EQ(step + 1, w.grad());
+    EXPECT_EQ(3, w.data());
+  }
+}
+
+TEST(TapeTest, NestedTapes) {
+  Tape outer;
+  auto a = outer.var(1.0);
+  {
+    Tape inner;
+    auto b = inner.var(2.0);
+    EXPECT_EQ(&inner, &Tape::active());
+    EXPECT_EQ(2, b.data());
+  }
+  EXPECT_EQ(&outer, &Tape::active());
+  EXPECT_EQ(1, a.data());
+}
+
+TEST(TapeGradTest, IndependentRun) {
+  Tape tape;
+  std::vector<Var> x, w, prod;
+  for (auto i = 0; i < 32; ++i) {
+    x.push_back(tape.var(i));
+    w.push_back(tape.var(-i));
+  }
+  // one run of 32 independent products, then a chain of adds sharing w[0]
+  for (auto i = 0; i < 32; ++i) {
+    prod.push_back(x[i] * w[i]);
+  }
+  auto sum = w[0];
+  for (auto i = 0; i < 32; ++i) {
+    sum = sum + prod[i] + w[0];
+  }
+  sum.backward();
+  for (auto i = 0; i < 32; ++i) {
+    EXPECT_EQ(x[i].grad(), -i);
+    EXPECT_EQ(w[i].grad(), i + (i == 0) * 33);
+  }
+}
+
+TEST(TapeGradTest, Mul) {
+  Tape tape;
+  auto a = tape.var(-4.0);
+  auto b = tape.var(2.0);
+  auto c = a * b;
+  c.backward();
+  EXPECT_EQ(a.grad(), 2.0);
+  EXPECT_EQ(b.grad(), -4.0);
+  EXPECT_EQ(c.grad(), 1.0);
+}
+
+TEST(TapeGradTest, ReluNeg) {
+  Tape tape;
+  auto a = tape.var(-4.0);
+  auto b = tape.var(2.0);
+  auto c = (a * b).relu() * b;
+  c.backward();
+  EXPECT_EQ(a.grad(), 0.0);
+  EXPECT_EQ(b.grad(), 0.0);
+}
+
+TEST(TapeGradTest, PowTestNeg) {
+  Tape tape;
+  auto a = tape.var(-4.0);
+  auto c = a.pow(-1.0);
+  c.backward();
+  EXPECT_EQ(a.grad(), -1.0 / 16);
+}
+
+TEST(TapeGradTest, DivTest) {
+  Tape tape;
+  auto a = tape.var(-4.0);
+  auto b = tape.var(-1.0);
+  auto c = a / b;
+  c.backward();
+  EXPECT_EQ(a.grad(), -1.0);
+  EXPECT_EQ(b.grad(), 4.0);
+}
+
+TEST(TapeGradTest, SanityCheck) {
+  Tape tape;
+  auto x = tape.var(-4.0);
+  auto z = 2.0 * x + 2.0 + x;
+  auto q = z.relu() + z * x;
+  auto h = (z * z).relu();
+  auto y = h + q + q * x;
+  y.backward();
+  EXPECT_EQ(y.data(), -20);
+  EXPECT_EQ(x.grad(), 46);
+}
+
+TEST(TapeGradTest, MoreOps) {
+  Tape tape;
+  auto a = tape.var(-4.0);
+  auto b = tape.var(2.0);
+  auto c = a + b;
+  auto d = a * b + b.pow(3.0);
+  c = c + c + 1.0;
+  c = c + 1.0 + c + (-a);
+  d = d + d * 2.0 + (b + a).relu();
+  d = d + 3.0 * d + (b - a).relu();
+  auto e = c - d;
+  auto f = e.pow(2.0);
+  auto g = f / 2.0;
+  g = g + 10.0 / f;
+  g.backward();
+  EXPECT_FLOAT_EQ(g.data(), 24.704082);
+  EXPECT_FLOAT_EQ(a.grad(), 138.833819);
+  EXPECT_FLOAT_EQ(b.grad(), 645.577259);
+}
+
+TEST(TapeCaptureTest, Replay) {
+  Tape tape;
+  auto w = tape.var(3.0);
+  auto capture = Capture(tape);
+  for (auto step = 1; step <= 3; ++step) {
+    auto expected = w.data() * step + 1;
+    auto y = capture.run([&]() {
+      auto x = tape.var(step);
+      return (w * x + 1.0).relu();
+    });
+    EXPECT_EQ(6, tape.size());
+    EXPECT_EQ(1, capture.records());
+    EXPECT_EQ(expected, y.data());
+    tape.zero_grad();
+    y.backward();
+    EXPECT_EQ(step, w.grad());
+    w.set_data(w.data() + 1);
+  }
+}
+
+TEST(TapeCaptureTest, ControlFlowChange) {
+  Tape tape;
+  auto w = tape.var(2.0);
+  auto capture = Capture(tape);
+  auto step = [&](double input) {
+    return capture.run([&]() {
+      auto x = tape.var(input);
+      return input > 0 ? w * x : w * x * x;
+    });
+  };
+  EXPECT_EQ(6, step(3).data());
+  EXPECT_EQ(6, step(3).data());
+  EXPECT_EQ(1, capture.records());
+  auto y = step(-3);
+  EXPECT_EQ(2, capture.records());
+  EXPECT_EQ(18, y.data());
+  EXPECT_EQ(4, tape.size());
+  y.backward();
+  EXPECT_EQ(9, w.grad());
+  EXPECT_EQ(2, step(-1).data());
+  EXPECT_EQ(2, capture.records());
+  EXPECT_EQ(8, step(4).data());
+  EXPECT_EQ(3, capture.records());
+  EXPECT_EQ(3, tape.size());
+}
+
+TEST(TapeCaptureTest, Forward) {
+  Tape tape;
+  auto a = tape.var(2.0);
+  auto b = tape.var(-3.0);
+  auto c = (a * b).relu() + a.pow(2.0) / b - a;
+  EXPECT_DOUBLE_EQ(-2.0 - 4.0 / 3, c.data());
+  a.set_data(-2.0);
+  tape.forward();
+  EXPECT_DOUBLE_EQ(6.0 - 4.0 / 3 + 2.0, c.data());
+}
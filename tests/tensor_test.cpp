@@ -0,0 +1,249 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <thread>
+#include <ugrad/engine.hpp>
+#include <vector>
+
+using std::make_shared;
+using std::vector;
+using ugrad::element;
+using ugrad::linear;
+using ugrad::make_tensor;
+using ugrad::matmul;
+using ugrad::Op;
+using ugrad::Value;
+using ugrad::ValuePtr;
+
+static vector<double> random_vector(size_t size, unsigned seed) {
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<> dist{-1.0, 1.0};
+  vector<double> out(size);
+  for (auto& v : out) {
+    v = dist(rng);
+  }
+  return out;
+}
+
+TEST(GemmTest, Transposes) {
+  const size_t m = 5, n = 7, k = 3;
+  auto a = random_vector(m * k, 1);
+  auto b = random_vector(k * n, 2);
+  for (auto trans_a : {false, true}) {
+    for (auto trans_b : {false, true}) {
+      vector<double> c(m * n, 1.0);
+      ugrad::gemm(trans_a, trans_b, m, n, k, a.data(), b.data(), c.data(),
+                  true);
+      for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+          double expected = 1.0;
+          for (size_t p = 0; p < k; ++p) {
+            expected += (trans_a ? a[p * m + i] : a[i * k + p]) *
+                        (trans_b ? b[j * k + p] : b[p * n + j]);
+          }
+          EXPECT_NEAR(expected, c[i * n + j], 1e-12);
+        }
+      }
+    }
+  }
+}
+
+TEST(TensorTest, LinearForward) {
+  // [[1, 2], [3, 4]] * [[1, 0, -1], [2, 1, 0]] + [0.5, 0, -0.5]
+  auto x = make_tensor(2, 2, {1, 2, 3, 4});
+  auto w = make_tensor(2, 3, {1, 0, -1, 2, 1, 0});
+  auto b = make_tensor(1, 3, {0.5, 0, -0.5});
+  auto y = linear(x, w, b);
+  EXPECT_EQ(Op::Linear, y->op());
+  const double expected[6] = {5.5, 2, -1.5, 11.5, 4, -3.5};
+  for (auto i = 0; i < 6; ++i) {
+    EXPECT_EQ(expected[i], y->tensor().data()[i]);
+  }
+  auto r = y->relu();
+  EXPECT_EQ(0.0, r->tensor().at(0, 2));
+  EXPECT_EQ(4.0, r->tensor().at(1, 1));
+}
+
+// the same affine map and loss built from scalar nodes gets the same grads
+TEST(TensorTest, LinearBackward) {
+  const size_t batch = 4, in = 3, out = 5;
+  auto xs = random_vector(batch * in, 3);
+  auto ws = random_vector(in * out, 4);
+  auto bs = random_vector(out, 5);
+
+  auto x = make_tensor(batch, in, xs);
+  auto w = make_tensor(in, out, ws);
+  auto b = make_tensor(1, out, bs);
+  auto y = linear(x, w, b)->relu();
+  vector<ValuePtr> squares;
+  for (size_t i = 0; i < batch; ++i) {
+    for (size_t j = 0; j < out; ++j) {
+      squares.push_back(element(y, i, j)->pow(2.0));
+    }
+  }
+  ugrad::sum(squares)->backward();
+
+  vector<ValuePtr> sx, sw, sb;
+  for (auto v : xs) sx.push_back(make_shared<Value>(v));
+  for (auto v : ws) sw.push_back(make_shared<Value>(v));
+  for (auto v : bs) sb.push_back(make_shared<Value>(v));
+  vector<ValuePtr> scalar_squares;
+  for (size_t i = 0; i < batch; ++i) {
+    for (size_t j = 0; j < out; ++j) {
+      auto act = sb[j];
+      for (size_t p = 0; p < in; ++p) {
+        act = act + sx[i * in + p] * sw[p * out + j];
+      }
+      scalar_squares.push_back(act->relu()->pow(2.0));
+    }
+  }
+  ugrad::sum(scalar_squares)->backward();
+
+  for (size_t i = 0; i < sx.size(); ++i) {
+    EXPECT_NEAR(sx[i]->grad(), x->tensor().grad()[i], 1e-12);
+  }
+  for (size_t i = 0; i < sw.size(); ++i) {
+    EXPECT_NEAR(sw[i]->grad(), w->tensor().grad()[i], 1e-12);
+  }
+  for (size_t i = 0; i < sb.size(); ++i) {
+    EXPECT_NEAR(sb[i]->grad(), b->tensor().grad()[i], 1e-12);
+  }
+}
+
+// the fused bias + relu node matches a Linear node followed by a relu node
+TEST(TensorTest, LinearReluFused) {
+  const size_t batch = 6, in = 4, out = 5;
+  auto xs = random_vector(batch * in, 6);
+  auto ws = random_vector(in * out, 7);
+  auto bs = random_vector(out, 8);
+  vector<ValuePtr> grads[2];
+  for (auto fused : {false, true}) {
+    auto x = make_tensor(batch, in, xs);
+    auto w = make_tensor(in, out, ws);
+    auto b = make_tensor(1, out, bs);
+    auto y = fused ? linear(x, w, b, true) : linear(x, w, b)->relu();
+    EXPECT_EQ(fused ? Op::LinearRelu : Op::TensorRelu, y->op());
+    ugrad::sum(y)->backward();
+    grads[fused] = {y, x, w, b};
+  }
+  for (size_t i = 0; i < batch * out; ++i) {
+    EXPECT_EQ(grads[0][0]->tensor().data()[i], grads[1][0]->tensor().data()[i]);
+  }
+  for (size_t t = 1; t < 4; ++t) {
+    auto& unfused = grads[0][t]->tensor();
+    auto& fused = grads[1][t]->tensor();
+    for (size_t i = 0; i < fused.size(); ++i) {
+      EXPECT_NEAR(unfused.grad()[i], fused.grad()[i], 1e-12);
+    }
+  }
+}
+
+TEST(TensorTest, MatMulBackward) {
+  auto a = make_tensor(2, 3, {1, 2, 3, 4, 5, 6});
+  auto b = make_tensor(3, 2, {1, -1, 0, 2, -2, 1});
+  auto c = matmul(a, b);
+  EXPECT_EQ(-5.0, c->tensor().at(0, 0));
+  ugrad::sum(c)->backward();
+  // d sum(AB)/dA[i][p] = sum_j B[p][j], d/dB[p][j] = sum_i A[i][p]
+  const double da[6] = {0, 2, -1, 0, 2, -1};
+  const double db[6] = {5, 5, 7, 7, 9, 9};
+  for (auto i = 0; i < 6; ++i) {
+    EXPECT_EQ(da[i], a->tensor().grad()[i]);
+    EXPECT_EQ(db[i], b->tensor().grad()[i]);
+  }
+}
+
+TEST(TensorTest, StackAndElement) {
+  auto a = make_shared<Value>(2.0);
+  auto b = make_shared<Value>(-3.0);
+  auto t = ugrad::stack({a, b, a * b, b});
+  ASSERT_EQ(1, t->tensor().rows());
+  ASSERT_EQ(4, t->tensor().cols());
+  auto out = element(t, 0, 2) * element(t, 0, 3) + ugrad::sum(t);
+  // (a b) b + (a + b + a b + b) = a b^2 + a + 2 b + a b
+  out->backward();
+  EXPECT_EQ(18 + 2 - 6 - 6, out->data());
+  EXPECT_EQ(9 + 1 - 3, a->grad());
+  EXPECT_EQ(-12 + 2 + 2, b->grad());
+}
+
+TEST(TensorTest, NoGrad) {
+  auto x = make_tensor(1, 2, {1, 2});
+  auto w = make_tensor(2, 1, {3, 4});
+  auto b = make_tensor(1, 1);
+  ugrad::NoGradGuard no_grad;
+  auto y = linear(x, w, b)->relu();
+  EXPECT_EQ(11.0, y->tensor().at(0, 0));
+  EXPECT_TRUE(y->children().empty());
+  EXPECT_FALSE(y->requires_grad());
+}
+
+TEST(TensorTest, ConcurrentBackward) {
+  const size_t batch = 8, in = 6, out = 4, threads = 4;
+  auto w = make_tensor(in, out, random_vector(in * out, 6));
+  auto b = make_tensor(1, out, random_vector(out, 7));
+  auto loss = [&](unsigned seed) {
+    auto x = make_tensor(batch, in, random_vector(batch * in, seed), false);
+    auto y = linear(x, w, b)->relu();
+    return ugrad::sum(linear(y, make_tensor(out, 1, vector<double>(out, 0.5),
+                                            false),
+                             make_tensor(1, 1, {}, false)));
+  };
+  for (unsigned t = 0; t < threads; ++t) {
+    loss(10 + t)->backward();
+  }
+  auto& wt = w->tensor();
+  auto& bt = b->tensor();
+  vector<double> expected_w(wt.grad(), wt.grad() + wt.size());
+  vector<double> expected_b(bt.grad(), bt.grad() + bt.size());
+  auto check = [&] {
+    for (size_t i = 0; i < expected_w.size(); ++i) {
+      EXPECT_NEAR(expected_w[i], w->tensor().grad()[i], 1e-12);
+    }
+    for (size_t i = 0; i < expected_b.size(); ++i) {
+      EXPECT_NEAR(expected_b[i], b->tensor().grad()[i], 1e-12);
+    }
+  };
+
+  w->zero_grad();
+  b->zero_grad();
+  vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      ugrad::AtomicGradGuard atomic;
+      loss(10 + t)->backward();
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  check();
+
+  w->zero_grad();
+  b->zero_grad();
+  workers.clear();
+  vector<ugrad::GradShard> shards(threads);
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      ugrad::ShardedGradGuard sharded{shards[t]};
+      loss(10 + t)->backward();
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(0.0, w->tensor().grad()[0]);
+  for (auto& shard : shards) {
+    shard.merge();
+  }
+  check();
+
+  w->zero_grad();
+  b->zero_grad();
+  ugrad::ThreadPool pool{threads};
+  for (unsigned t = 0; t < threads; ++t) {
+    loss(10 + t)->backward(pool);
+  }
+  check();
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <ugrad/thread_pool.hpp>
+#include <vector>
+
+using ugrad::parallel_for;
+using ugrad::parallel_invoke;
+using ugrad::TaskGroup;
+using ugrad::ThreadPool;
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  ThreadPool pool{4};
+  EXPECT_EQ(4, pool.size());
+  std::atomic<int> sum{0};
+  {
+    TaskGroup group{pool};
+    for (auto i = 1; i <= 1000; ++i) {
+      group.run([&sum, i] { sum += i; });
+    }
+    group.wait();
+    EXPECT_EQ(500500, sum);
+  }
+}
+
+TEST(ThreadPoolTest, SingleThreadRunsInline) {
+  ThreadPool pool{1};
+  auto caller = std::this_thread::get_id();
+  auto inline_only = true;
+  TaskGroup group{pool};
+  for (auto i = 0; i < 10; ++i) {
+    group.run([&] { inline_only &= std::this_thread::get_id() == caller; });
+  }
+  group.wait();
+  EXPECT_TRUE(inline_only);
+}
+
+// tasks forking tasks of their own and waiting on them must not deadlock
+static int fib(ThreadPool& pool, int n) {
+  if (n < 2) {
+    return n;
+  }
+  int lhs = 0;
+  TaskGroup group{pool};
+  group.run([&] { lhs = fib(pool, n - 1); });
+  auto rhs = fib(pool, n - 2);
+  group.wait();
+  return lhs + rhs;
+}
+
+TEST(ThreadPoolTest, NestedForkJoin) {
+  ThreadPool pool{3};
+  EXPECT_EQ(610, fib(pool, 15));
+}
+
+TEST(ThreadPoolTest, ParallelForVisitsEachIndexOnce) {
+  ThreadPool pool{4};
+  for (size_t n : {0, 1, 7, 1000, 4096}) {
+    for (size_t grain : {1, 3, 64}) {
+      std::vector<std::atomic<int>> hits(n);
+      parallel_for(pool, 0, n, [&](size_t i) { ++hits[i]; }, grain);
+      for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(1, hits[i]) << "n=" << n << " grain=" << grain;
+      }
+    }
+  }
+}
+
+TEST(ThreadPoolTest, ParallelForNested) {
+  ThreadPool pool{3};
+  std::atomic<size_t> sum{0};
+  parallel_for(pool, 0, 32, [&](size_t i) {
+    parallel_for(pool, 0, 32, [&](size_t j) { sum += i * 32 + j; });
+  });
+  EXPECT_EQ(1023 * 1024 / 2, sum);
+}
+
+TEST(ThreadPoolTest, ParallelInvoke) {
+  ThreadPool pool{2};
+  int a = 0, b = 0, c = 0;
+  parallel_invoke(pool, [&] { a = 1; }, [&] { b = 2; }, [&] { c = 3; });
+  EXPECT_EQ(6, a + b + c);
+}
+
+TEST(ThreadPoolTest, NumThreads) {
+  auto threads = ugrad::num_threads();
+  ugrad::set_num_threads(3);
+  EXPECT_EQ(3, ugrad::num_threads());
+  EXPECT_EQ(3, ugrad::default_pool()->size());
+  ugrad::set_num_threads(threads);
+  EXPECT_EQ(threads, ugrad::num_threads());
+}
+
+// a pool replaced while a loop still runs on it lives until the loop is done
+TEST(ThreadPoolTest, ResizeWhileInUse) {
+  auto threads = ugrad::num_threads();
+  ugrad::set_num_threads(2);
+  std::atomic<bool> started{false};
+  std::atomic<size_t> sum{0};
+  std::thread user{[&] {
+    auto pool = ugrad::default_pool();
+    parallel_for(*pool, 0, 1000, [&](size_t i) {
+      started = true;
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+      sum += i;
+    });
+  }};
+  while (!started) {
+    std::this_thread::yield();
+  }
+  ugrad::set_num_threads(3);
+  user.join();
+  EXPECT_EQ(999 * 1000 / 2, sum);
+  EXPECT_EQ(3, ugrad::num_threads());
+  ugrad::set_num_threads(threads);
+}
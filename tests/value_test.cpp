@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 #include <ugrad/engine.hpp>
@@ -7,6 +11,7 @@
 using std::make_shared;
 using std::vector;
 using ugrad::Value;
+using ugrad::ValuePtr;
 
 TEST(ValueTest, Add) {
   auto a = make_shared<Value>(-1.0);
@@ -266,3 +271,399 @@ TEST(GradTest, MoreOps) {
   EXPECT_FLOAT_EQ(a->grad(), 138.833819);
   EXPECT_FLOAT_EQ(b->grad(), 645.577259);
 }
+
+TEST(GradTest, DeepChain) {
+  const size_t depth = 200000;
+  auto a = make_shared<Value>(0.5);
+  auto sum = make_shared<Value>(0.0);
+  for (size_t i = 0; i < depth; ++i) {
+    sum = sum + a;
+  }
+  sum->backward();
+  EXPECT_FLOAT_EQ(sum->data(), depth * 0.5);
+  EXPECT_FLOAT_EQ(a->grad(), depth);
+  EXPECT_EQ(sum->build_topo().size(), depth + 2);
+}
+
+// dropping the root frees the chain through the worklist, not recursion
+TEST(TeardownTest, DropLongChain) {
+  const size_t length = 10000000;
+  auto x = make_shared<Value>(0.0);
+  std::weak_ptr<Value> first = x;
+  for (size_t i = 0; i < length; ++i) {
+    x = x + 1.0;
+  }
+  EXPECT_EQ(x->data(), length);
+  x.reset();
+  EXPECT_TRUE(first.expired());
+}
+
+TEST(TeardownTest, SharedNodesSurvive) {
+  auto a = make_shared<Value>(2.0);
+  auto b = a * 3.0;
+  auto c = (b + a)->relu();
+  c.reset();
+  // b is still held here, so its children stay linked
+  ASSERT_EQ(b->children().size(), 1);
+  EXPECT_EQ(b->children()[0], a);
+  EXPECT_EQ(a.use_count(), 2);
+}
+
+TEST(TeardownTest, Deferred) {
+  ugrad::Reclaimer::set_deferred(true);
+  auto x = make_shared<Value>(0.0);
+  std::weak_ptr<Value> first = x;
+  for (size_t i = 0; i < 1000000; ++i) {
+    x = x + 1.0;
+  }
+  x.reset();
+  ugrad::Reclaimer::drain();
+  EXPECT_TRUE(first.expired());
+  ugrad::Reclaimer::set_deferred(false);
+}
+
+// d/dx x^3 = 3x^2, registered through the custom op extension point
+static void cube_backward(Value& out) {
+  auto x = out.children()[0];
+  Value::accumulate(x, 3 * x->data() * x->data() * out.grad());
+}
+
+TEST(GradTest, CustomOp) {
+  static const auto cube = ugrad::register_op(cube_backward);
+  auto a = make_shared<Value>(-2.0);
+  auto b = make_shared<Value>(3.0);
+  auto c = make_shared<Value>(std::pow(a->data(), 3), vector<ValuePtr>{a},
+                              cube) * b;
+  c->backward();
+  EXPECT_EQ(c->data(), -24);
+  EXPECT_EQ(a->grad(), 36);
+  EXPECT_EQ(b->grad(), -8);
+}
+
+// registrations on several threads get distinct codes past the built-ins
+TEST(GradTest, ConcurrentRegisterOp) {
+  vector<ugrad::Op> codes(4);
+  vector<std::thread> threads;
+  for (size_t i = 0; i < codes.size(); ++i) {
+    threads.emplace_back(
+        [&codes, i] { codes[i] = ugrad::register_op(cube_backward); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::sort(codes.begin(), codes.end());
+  EXPECT_EQ(std::unique(codes.begin(), codes.end()), codes.end());
+  EXPECT_GE(codes[0], ugrad::Op::Custom);
+}
+
+// in a child process, which uses up every code without touching this one's
+TEST(GradTest, RegisterOpExhausted) {
+  EXPECT_EXIT(
+      {
+        auto last = ugrad::Op::Leaf;
+        try {
+          for (size_t i = 0; i < 256; ++i) {
+            last = ugrad::register_op(cube_backward);
+          }
+        } catch (const std::length_error&) {
+          std::exit(static_cast<size_t>(last) == 255 ? 0 : 1);
+        }
+        std::exit(2);
+      },
+      ::testing::ExitedWithCode(0), "");
+}
+
+TEST(GradTest, OpCodes) {
+  auto a = make_shared<Value>(2.0);
+  auto b = make_shared<Value>(4.0);
+  EXPECT_EQ((a + b)->op(), ugrad::Op::Add);
+  EXPECT_EQ((a * b)->op(), ugrad::Op::Mul);
+  EXPECT_EQ((a / b)->op(), ugrad::Op::Div);
+  EXPECT_EQ((-a)->op(), ugrad::Op::Neg);
+  EXPECT_EQ(a->relu()->op(), ugrad::Op::Relu);
+  EXPECT_EQ(a->pow(3)->op(), ugrad::Op::Pow);
+  EXPECT_EQ(a->pow(3)->aux(), 3);
+  EXPECT_EQ(a->op(), ugrad::Op::Leaf);
+}
+
+TEST(GradTest, Sum) {
+  auto a = make_shared<Value>(-4.0);
+  auto b = make_shared<Value>(2.0);
+  auto c = ugrad::sum({a, b, a}) * b;
+  c->backward();
+  EXPECT_EQ(c->data(), -12);
+  EXPECT_EQ(c->children()[0]->children().size(), 3);
+  EXPECT_EQ(a->grad(), 4);
+  EXPECT_EQ(b->grad(), -4);
+}
+
+TEST(GradTest, Dot) {
+  auto a = make_shared<Value>(-4.0);
+  auto b = make_shared<Value>(2.0);
+  auto c = make_shared<Value>(3.0);
+  auto d = ugrad::dot({a, b, c}, {c, b, b});
+  d->backward();
+  EXPECT_EQ(d->data(), -12 + 4 + 6);
+  EXPECT_EQ(ugrad::dot({a, b}, {a, b})->data(), 20);
+  EXPECT_EQ(a->grad(), 3);
+  EXPECT_EQ(b->grad(), 2 * 2 + 3);
+  EXPECT_EQ(c->grad(), -4 + 2);
+}
+
+TEST(GradTest, ConstOperands) {
+  auto a = make_shared<Value>(-4.0);
+  auto b = (3.0 + a * 2.0) / 5.0 + 1.0 / a;
+  b->backward();
+  EXPECT_DOUBLE_EQ(b->data(), -1.0 - 0.25);
+  EXPECT_DOUBLE_EQ(a->grad(), 2.0 / 5.0 - 1.0 / 16);
+  EXPECT_EQ(b->children()[0]->op(), ugrad::Op::DivConst);
+  EXPECT_EQ(b->children()[1]->op(), ugrad::Op::RDivConst);
+  ASSERT_EQ(b->children()[1]->children().size(), 1);
+}
+
+TEST(GradTest, RequiresGrad) {
+  auto x = make_shared<Value>(3.0, false);
+  auto y = make_shared<Value>(-2.0, false);
+  auto w = make_shared<Value>(2.0);
+  auto data_only = x * y;
+  EXPECT_FALSE(data_only->requires_grad());
+  auto out = data_only * w + x;
+  EXPECT_TRUE(out->requires_grad());
+  out->backward();
+  EXPECT_EQ(w->grad(), -6.0);
+  // data_only and x cannot reach w, so backward never visits them
+  EXPECT_EQ(data_only->grad(), 0.0);
+  EXPECT_EQ(x->grad(), 0.0);
+  EXPECT_EQ(y->grad(), 0.0);
+  EXPECT_EQ(out->build_topo(true).size(), 3);
+  EXPECT_EQ(out->build_topo().size(), 6);
+}
+
+TEST(NoGradTest, ValuesOnly) {
+  auto a = make_shared<Value>(-4.0);
+  auto b = make_shared<Value>(2.0);
+  ValuePtr c;
+  {
+    ugrad::NoGradGuard no_grad;
+    EXPECT_FALSE(ugrad::GradMode::is_enabled());
+    c = (a * b + 1.0)->relu() + ugrad::dot({a, b}, {b, b}) / b;
+  }
+  EXPECT_TRUE(ugrad::GradMode::is_enabled());
+  EXPECT_EQ(c->data(), -2);
+  EXPECT_TRUE(c->children().empty());
+  EXPECT_FALSE(c->requires_grad());
+  c->backward();
+  EXPECT_EQ(a->grad(), 0);
+  EXPECT_EQ(b->grad(), 0);
+}
+
+TEST(NoGradTest, Nested) {
+  ugrad::NoGradGuard outer;
+  {
+    ugrad::NoGradGuard inner;
+    EXPECT_FALSE(ugrad::GradMode::is_enabled());
+  }
+  EXPECT_FALSE(ugrad::GradMode::is_enabled());
+}
+
+TEST(NoGradTest, Pooled) {
+  auto a = make_shared<Value>(3.0);
+  ugrad::NoGradGuard no_grad;
+  const Value* first = nullptr;
+  {
+    auto b = a * a;
+    first = b.get();
+  }
+  // the next result reuses the block the previous one released
+  auto c = a + a;
+  EXPECT_EQ(c.get(), first);
+  EXPECT_EQ(c->data(), 6);
+}
+
+// central difference of f at x, to check the closed-form backward of f
+template <typename F>
+static double numeric_grad(F f, double x) {
+  const double h = 1e-6;
+  auto hi = f(make_shared<Value>(x + h))->data();
+  auto lo = f(make_shared<Value>(x - h))->data();
+  return (hi - lo) / (2 * h);
+}
+
+template <typename F>
+static void expect_grad(F f, double x, ugrad::Op op) {
+  auto a = make_shared<Value>(x);
+  auto out = f(a);
+  EXPECT_EQ(out->op(), op);
+  out->backward();
+  EXPECT_NEAR(a->grad(), numeric_grad(f, x), 1e-6);
+}
+
+TEST(OpTest, Sub) {
+  auto a = make_shared<Value>(-4.0);
+  auto b = make_shared<Value>(2.5);
+  auto c = a - b;
+  EXPECT_EQ(c->op(), ugrad::Op::Sub);
+  c->backward();
+  EXPECT_EQ(c->data(), -6.5);
+  EXPECT_EQ(a->grad(), 1);
+  EXPECT_EQ(b->grad(), -1);
+  expect_grad([](ValuePtr x) { return 3.0 - x; }, 1.5, ugrad::Op::RSubConst);
+  expect_grad([](ValuePtr x) { return x - 3.0; }, 1.5, ugrad::Op::AddConst);
+}
+
+TEST(OpTest, Div) {
+  auto b = make_shared<Value>(4.0);
+  expect_grad([&](ValuePtr x) { return x / b; }, 1.5, ugrad::Op::Div);
+  expect_grad([&](ValuePtr x) { return b / x; }, 1.5, ugrad::Op::Div);
+}
+
+TEST(OpTest, Neg) {
+  expect_grad([](ValuePtr x) { return -x; }, 1.5, ugrad::Op::Neg);
+}
+
+TEST(OpTest, Exp) {
+  expect_grad([](ValuePtr x) { return x->exp(); }, 1.5, ugrad::Op::Exp);
+}
+
+TEST(OpTest, Log) {
+  expect_grad([](ValuePtr x) { return x->log(); }, 1.5, ugrad::Op::Log);
+}
+
+TEST(OpTest, Tanh) {
+  expect_grad([](ValuePtr x) { return x->tanh(); }, 0.7, ugrad::Op::Tanh);
+  expect_grad([](ValuePtr x) { return x->tanh(); }, -2.0, ugrad::Op::Tanh);
+}
+
+TEST(OpTest, Sigmoid) {
+  expect_grad([](ValuePtr x) { return x->sigmoid(); }, 0.7,
+              ugrad::Op::Sigmoid);
+  expect_grad([](ValuePtr x) { return x->sigmoid(); }, -3.0,
+              ugrad::Op::Sigmoid);
+  EXPECT_EQ(make_shared<Value>(-1000.0)->sigmoid()->data(), 0.0);
+  EXPECT_EQ(make_shared<Value>(1000.0)->sigmoid()->data(), 1.0);
+}
+
+TEST(OpTest, PowSpecializations) {
+  expect_grad([](ValuePtr x) { return x->pow(2.0); }, -1.5, ugrad::Op::Square);
+  expect_grad([](ValuePtr x) { return x->pow(-1.0); }, -1.5,
+              ugrad::Op::Reciprocal);
+  expect_grad([](ValuePtr x) { return x->pow(0.5); }, 2.5, ugrad::Op::Sqrt);
+  expect_grad([](ValuePtr x) { return x->pow(3.0); }, -1.5, ugrad::Op::Pow);
+  EXPECT_EQ(make_shared<Value>(9.0)->pow(0.5)->data(), 3.0);
+}
+
+// each call builds and differentiates its own graphs over the shared leaves,
+// d/dw (w x + b)^2 = 2 (w x + b) x
+static void fit_samples(const ValuePtr& w, const ValuePtr& b, size_t thread,
+                        size_t samples) {
+  for (size_t i = 0; i < samples; ++i) {
+    auto x = make_shared<Value>(0.01 * (thread * samples + i), false);
+    auto loss = (w * x + b)->pow(2.0);
+    loss->backward();
+  }
+}
+
+static void expected_grads(double w, double b, size_t samples, double& dw,
+                           double& db) {
+  dw = db = 0.0;
+  for (size_t i = 0; i < samples; ++i) {
+    auto x = 0.01 * i;
+    dw += 2 * (w * x + b) * x;
+    db += 2 * (w * x + b);
+  }
+}
+
+TEST(ConcurrencyTest, SharedTopoSort) {
+  auto a = make_shared<Value>(1.0);
+  auto b = make_shared<Value>(2.0);
+  vector<std::thread> workers;
+  vector<size_t> sizes(4);
+  for (size_t t = 0; t < sizes.size(); ++t) {
+    workers.emplace_back([&, t] {
+      for (auto i = 0; i < 1000; ++i) {
+        auto c = (a * b + a)->relu();
+        sizes[t] = std::max(sizes[t], c->build_topo().size());
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(sizes, vector<size_t>(4, 5));
+}
+
+TEST(ConcurrencyTest, AtomicGrad) {
+  const size_t threads = 4, samples = 500;
+  auto w = make_shared<Value>(0.5);
+  auto b = make_shared<Value>(-1.0);
+  vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      ugrad::AtomicGradGuard atomic;
+      fit_samples(w, b, t, samples);
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  double dw, db;
+  expected_grads(0.5, -1.0, threads * samples, dw, db);
+  EXPECT_NEAR(dw, w->grad(), 1e-6 * std::abs(dw));
+  EXPECT_NEAR(db, b->grad(), 1e-6 * std::abs(db));
+  EXPECT_EQ(ugrad::GradMode::accumulation(), ugrad::Accumulation::Plain);
+}
+
+TEST(ConcurrencyTest, ShardedGrad) {
+  const size_t threads = 4, samples = 500;
+  auto w = make_shared<Value>(0.5);
+  auto b = make_shared<Value>(-1.0);
+  vector<ugrad::GradShard> shards(threads);
+  vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      ugrad::ShardedGradGuard sharded{shards[t]};
+      fit_samples(w, b, t, samples);
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  // nothing reaches the leaves before the merge
+  EXPECT_EQ(0, w->grad());
+  EXPECT_EQ(2, shards[0].size());
+  for (auto& shard : shards) {
+    shard.merge();
+  }
+  double dw, db;
+  expected_grads(0.5, -1.0, threads * samples, dw, db);
+  EXPECT_NEAR(dw, w->grad(), 1e-6 * std::abs(dw));
+  EXPECT_NEAR(db, b->grad(), 1e-6 * std::abs(db));
+}
+
+// a graph whose interior nodes have several consumers, swept on pools of
+// different sizes, gets the serial grads
+TEST(ConcurrencyTest, ParallelBackward) {
+  auto build = [](vector<ValuePtr>& leaves) {
+    for (auto i = 0; i < 64; ++i) {
+      leaves.push_back(make_shared<Value>(0.1 * i - 3.0));
+    }
+    vector<ValuePtr> hidden;
+    for (auto i = 0; i < 32; ++i) {
+      auto shared = leaves[i] * leaves[i + 32] + leaves[(i * 7) % 64];
+      hidden.push_back(shared->tanh() + shared * shared);
+    }
+    auto out = ugrad::sum(hidden);
+    return out * out + ugrad::dot(hidden, hidden);
+  };
+  vector<ValuePtr> serial;
+  build(serial)->backward();
+  for (auto threads : {1, 2, 4}) {
+    ugrad::ThreadPool pool(threads);
+    vector<ValuePtr> leaves;
+    build(leaves)->backward(pool);
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      EXPECT_NEAR(serial[i]->grad(), leaves[i]->grad(),
+                  1e-9 * std::max(1.0, std::abs(serial[i]->grad())));
+    }
+  }
+}